@@ -0,0 +1,477 @@
+#include "bench_sodium.h"
+#include <sodium/sodium.h>
+#include <sodium/router.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <random>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+using namespace sodium;
+
+std::atomic<unsigned long> allocation_count(0);
+
+void* operator new(std::size_t size)
+{
+    ++allocation_count;
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+// One send through a chain of 10k map nodes.
+static void chain_10k()
+{
+    stream_sink<int> sa;
+    std::shared_ptr<int> out = std::make_shared<int>(0);
+    function<void()> unlisten;
+    {
+        transaction trans;
+        stream<int> s = sa;
+        for (int i = 0; i < 10000; ++i) {
+            s = s.map([] (const int& x) { return x + 1; });
+        }
+        unlisten = s.listen([out] (const int& x) { *out = x; });
+    }
+    bench("propagate/chain_10k", 100, [sa] () { sa.send(1); });
+    unlisten();
+}
+
+// One send through a pipeline of map stages, the typical operator chain.
+static void map_chain(int depth, unsigned int iterations)
+{
+    stream_sink<int> sa;
+    std::shared_ptr<int> out = std::make_shared<int>(0);
+    function<void()> unlisten;
+    {
+        transaction trans;
+        stream<int> s = sa;
+        for (int i = 0; i < depth; ++i) {
+            s = s.map([] (const int& x) { return x + 1; });
+        }
+        unlisten = s.listen([out] (const int& x) { *out = x; });
+    }
+    bench("propagate/map_chain_" + std::to_string(depth), iterations, [sa] () { sa.send(1); });
+    unlisten();
+}
+
+// One send to a stream with many listeners.
+static void fan_out(int n_listeners, unsigned int iterations)
+{
+    stream_sink<int> sa;
+    std::shared_ptr<int> out = std::make_shared<int>(0);
+    vector<function<void()>> unlistens;
+    {
+        transaction trans;
+        for (int i = 0; i < n_listeners; ++i) {
+            unlistens.push_back(sa.listen([out] (const int& x) { *out += x; }));
+        }
+    }
+    bench("propagate/fan_out_" + std::to_string(n_listeners), iterations, [sa] () { sa.send(1); });
+    for (auto unlisten = unlistens.begin(); unlisten != unlistens.end(); ++unlisten) {
+        (*unlisten)();
+    }
+}
+
+// One send into a merge of 256 streams, the per-instrument fan in.
+static void fan_in_256()
+{
+    vector<stream_sink<int>> sinks(256);
+    vector<stream<int>> ss(sinks.begin(), sinks.end());
+    std::shared_ptr<int> out = std::make_shared<int>(0);
+    collect_cycles();
+    int nodes_before = num_nodes();
+    stream<int> merged = merge<int>(ss, [] (const int& x, const int& y) { return x + y; });
+    std::cout << "propagate/fan_in_256: " << (num_nodes() - nodes_before) << " nodes" << std::endl;
+    function<void()> unlisten = merged.listen([out] (const int& x) { *out = x; });
+    stream_sink<int> sa = sinks[100];
+    bench("propagate/fan_in_256", 100000, [sa] () { sa.send(1); });
+    unlisten();
+}
+
+// 1M sends through a router to 10k keyed outputs, each with a listener.
+static void route_10k_keys()
+{
+    const int n_keys = 10000;
+    stream_sink<int> sa;
+    router<int, int> r(sa, [n_keys] (const int& x) { return x % n_keys; });
+    std::shared_ptr<long> out = std::make_shared<long>(0);
+    vector<function<void()>> unlistens;
+    {
+        transaction trans;
+        for (int i = 0; i < n_keys; ++i) {
+            unlistens.push_back(r.filter_equals(i).listen([out] (const int& x) { *out += x; }));
+        }
+    }
+    std::shared_ptr<int> next = std::make_shared<int>(0);
+    bench("route/1m_events_10k_keys", 1000000, [sa, next] () { sa.send((*next)++); });
+    for (auto unlisten = unlistens.begin(); unlisten != unlistens.end(); ++unlisten) {
+        (*unlisten)();
+    }
+}
+
+// Replaying a batch of 1k ticks: a send() per tick, send_all() with a
+// transaction per tick, and send_all() in one transaction.
+static void send_batch_1k()
+{
+    stream_sink<int> sa([] (const int& x, const int& y) { return y; });
+    std::shared_ptr<int> out = std::make_shared<int>(0);
+    function<void()> unlisten = sa.map([] (const int& x) { return x + 1; })
+        .listen([out] (const int& x) { *out = x; });
+    vector<int> ticks(1000, 1);
+    bench("send/batch_1k_send", 1000, [sa, &ticks] () {
+        for (auto tick = ticks.begin(); tick != ticks.end(); ++tick) {
+            sa.send(*tick);
+        }
+    });
+    bench("send/batch_1k_per_item", 1000, [sa, &ticks] () {
+        sa.send_all(ticks.begin(), ticks.end(), drain_mode::transaction_per_item);
+    });
+    bench("send/batch_1k_one_transaction", 1000, [sa, &ticks] () {
+        sa.send_all(ticks.begin(), ticks.end());
+    });
+    unlisten();
+}
+
+// A counter built on accum, fed 1M events.
+static void accum_counter_1m()
+{
+    stream_sink<int> sa;
+    std::shared_ptr<int> out = std::make_shared<int>(0);
+    cell<int> total = sa.accum<int>(0, [] (const int& a, const int& s) { return a + s; });
+    function<void()> unlisten = total.updates().listen([out] (const int& x) { *out = x; });
+    bench("accum/counter_1m", 1000000, [sa] () { sa.send(1); });
+    unlisten();
+}
+
+// A hold updated by one sink and snapshotted by another.
+static void hold_snapshot()
+{
+    stream_sink<int> sa;
+    stream_sink<int> sb;
+    std::shared_ptr<int> out = std::make_shared<int>(0);
+    cell<int> ca = sa.hold(0);
+    function<void()> unlisten = sb.snapshot(ca, [] (const int& b, const int& a) { return a + b; })
+        .listen([out] (const int& x) { *out = x; });
+    bench("hold/update", 1000000, [sa] () { sa.send(1); });
+    bench("hold/snapshot", 1000000, [sb] () { sb.send(1); });
+    unlisten();
+}
+
+// An update to one input of a lift of two to five cells. lift_6 covers six.
+static void lift_2_to_5()
+{
+    cell_sink<int> a(0), b(0), c(0), d(0), e(0);
+    std::shared_ptr<int> out = std::make_shared<int>(0);
+    // Each lift is unlistened before the next is timed, so a send only
+    // reaches the lift being measured.
+    function<void()> unlisten = a.lift(b, [] (const int& a, const int& b) {
+        return a + b;
+    }).listen([out] (const int& x) { *out = x; });
+    bench("lift/lift_2", 100000, [a] () { a.send(1); });
+    unlisten();
+    unlisten = a.lift(b, c, [] (const int& a, const int& b, const int& c) {
+        return a + b + c;
+    }).listen([out] (const int& x) { *out = x; });
+    bench("lift/lift_3", 100000, [a] () { a.send(1); });
+    unlisten();
+    unlisten = a.lift(b, c, d, [] (const int& a, const int& b, const int& c, const int& d) {
+        return a + b + c + d;
+    }).listen([out] (const int& x) { *out = x; });
+    bench("lift/lift_4", 100000, [a] () { a.send(1); });
+    unlisten();
+    unlisten = a.lift(b, c, d, e, [] (const int& a, const int& b, const int& c, const int& d, const int& e) {
+        return a + b + c + d + e;
+    }).listen([out] (const int& x) { *out = x; });
+    bench("lift/lift_5", 100000, [a] () { a.send(1); });
+    unlisten();
+}
+
+// A six-input lift, which is one node, against the chain of pairwise lifts
+// packing tuples that lift6 used to be built from. Prints the nodes each
+// makes, then times an update to one input.
+static void lift_6()
+{
+    cell_sink<int> a(0), b(0), c(0), d(0), e(0), f(0);
+    std::shared_ptr<int> out = std::make_shared<int>(0);
+    {
+        collect_cycles();
+        int nodes_before = num_nodes();
+        cell<int> sum = a.lift(b, c, d, e, f,
+            [] (const int& a, const int& b, const int& c, const int& d, const int& e, const int& f) {
+                return a + b + c + d + e + f;
+            });
+        std::cout << "lift/lift_6: " << (num_nodes() - nodes_before) << " nodes" << std::endl;
+        function<void()> unlisten = sum.listen([out] (const int& x) { *out = x; });
+        bench("lift/lift_6", 100000, [a] () { a.send(1); });
+        unlisten();
+    }
+    {
+        typedef std::tuple<int, int> T2;
+        typedef std::tuple<int, int, int> T3;
+        typedef std::tuple<int, int, int, int> T4;
+        typedef std::tuple<int, int, int, int, int> T5;
+        collect_cycles();
+        int nodes_before = num_nodes();
+        cell<int> sum = a
+            .lift(b, [] (const int& a, const int& b) { return T2(a, b); })
+            .lift(c, [] (const T2& t, const int& c) { return T3(std::get<0>(t), std::get<1>(t), c); })
+            .lift(d, [] (const T3& t, const int& d) { return T4(std::get<0>(t), std::get<1>(t), std::get<2>(t), d); })
+            .lift(e, [] (const T4& t, const int& e) { return T5(std::get<0>(t), std::get<1>(t), std::get<2>(t), std::get<3>(t), e); })
+            .lift(f, [] (const T5& t, const int& f) {
+                return std::get<0>(t) + std::get<1>(t) + std::get<2>(t) + std::get<3>(t) + std::get<4>(t) + f;
+            });
+        std::cout << "lift/pairwise_6: " << (num_nodes() - nodes_before) << " nodes" << std::endl;
+        function<void()> unlisten = sum.listen([out] (const int& x) { *out = x; });
+        bench("lift/pairwise_6", 100000, [a] () { a.send(1); });
+        unlisten();
+    }
+}
+
+// A 10k element value held in a cell and read by four lifts and a snapshot.
+// The one copy per send is made by the sender; the cell and its observers
+// share the value.
+static void hold_large_value()
+{
+    vector<int> book(10000, 1);
+    stream_sink<vector<int>> sa;
+    stream_sink<int> sq;
+    std::shared_ptr<int> out = std::make_shared<int>(0);
+    cell<vector<int>> cb = sa.hold(book);
+    cell<int> one(1);
+    vector<function<void()>> unlistens;
+    for (int i = 0; i < 4; ++i) {
+        unlistens.push_back(cb.lift(one, [i] (const vector<int>& b, const int& x) {
+            return b[i] + x;
+        }).listen([out] (const int& x) { *out = x; }));
+    }
+    unlistens.push_back(sq.snapshot(cb, [] (const int& q, const vector<int>& b) {
+        return b[q];
+    }).listen([out] (const int& x) { *out = x; }));
+    bench("hold/large_value", 10000, [sa, sq, book] () {
+        sa.send(vector<int>(book));
+        sq.send(0);
+    });
+    for (auto unlisten = unlistens.begin(); unlisten != unlistens.end(); ++unlisten) {
+        (*unlisten)();
+    }
+}
+
+// Switching between two inner streams or cells, then sending through the
+// new one. Each switch rewires the graph.
+static void switch_churn()
+{
+    stream_sink<int> s1, s2;
+    cell_sink<int> c1(1), c2(2);
+    cell_sink<stream<int>> css(s1);
+    cell_sink<cell<int>> ccs(c1);
+    std::shared_ptr<int> out = std::make_shared<int>(0);
+    function<void()> unlisten_s = switch_s(css).listen([out] (const int& x) { *out = x; });
+    function<void()> unlisten_c = switch_c(ccs).listen([out] (const int& x) { *out = x; });
+    std::shared_ptr<bool> flip = std::make_shared<bool>(false);
+    bench("switch/switch_s", 100000, [css, s1, s2, flip] () {
+        *flip = !*flip;
+        css.send(*flip ? s2 : s1);
+        (*flip ? s2 : s1).send(1);
+    });
+    bench("switch/switch_c", 100000, [ccs, c1, c2, flip] () {
+        *flip = !*flip;
+        ccs.send(*flip ? c2 : c1);
+        (*flip ? c2 : c1).send(1);
+    });
+    unlisten_s();
+    unlisten_c();
+}
+
+// switch_s flipping between two streams that each have 10k other listeners,
+// so every re-wire removes an edge from a large dependents list.
+static void switch_s_fan_out_10k()
+{
+    stream_sink<int> s1, s2;
+    std::shared_ptr<int> out = std::make_shared<int>(0);
+    vector<function<void()>> unlistens;
+    {
+        transaction trans;
+        for (int i = 0; i < 10000; ++i) {
+            unlistens.push_back(s1.listen([out] (const int& x) { *out += x; }));
+            unlistens.push_back(s2.listen([out] (const int& x) { *out += x; }));
+        }
+    }
+    cell_sink<stream<int>> css(s1);
+    unlistens.push_back(switch_s(css).listen([out] (const int& x) { *out = x; }));
+    std::shared_ptr<bool> flip = std::make_shared<bool>(false);
+    bench("switch/switch_s_fan_out_10k", 10000, [css, s1, s2, flip] () {
+        *flip = !*flip;
+        css.send(*flip ? s2 : s1);
+    });
+    for (auto unlisten = unlistens.begin(); unlisten != unlistens.end(); ++unlisten) {
+        (*unlisten)();
+    }
+}
+
+// Build a chain of 100k map nodes, then drop it again.
+static void construct_chain_100k()
+{
+    stream_sink<int> sa;
+    bench("construct/chain_100k", 10, [sa] () {
+        {
+            transaction trans;
+            stream<int> s = sa;
+            for (int i = 0; i < 100000; ++i) {
+                s = s.map([] (const int& x) { return x + 1; });
+            }
+        }
+        collect_cycles();
+    });
+}
+
+// Build 10k accumulators, each a cell_loop fed back through a snapshot, then
+// drop them and collect the cycles.
+static void collect_loops_10k()
+{
+    stream_sink<int> sa;
+    bench("collect/loops_10k", 10, [sa] () {
+        {
+            transaction trans;
+            for (int i = 0; i < 10000; ++i) {
+                cell_loop<int> total;
+                total.loop(sa.snapshot(total, [] (const int& a, const int& t) { return a + t; }).hold(0));
+            }
+        }
+        collect_cycles();
+    });
+}
+
+// Register 100k listeners on one stream, then unlisten them in random order,
+// as client sessions come and go.
+static void listeners_100k()
+{
+    const int n_listeners = 100000;
+    stream_sink<int> sa;
+    std::shared_ptr<int> out = std::make_shared<int>(0);
+    vector<int> order(n_listeners);
+    for (int i = 0; i < n_listeners; ++i) {
+        order[i] = i;
+    }
+    std::mt19937 rng(1);
+    std::shuffle(order.begin(), order.end(), rng);
+    bench("listen/listen_unlisten_100k", 10, [sa, out, &order] () {
+        vector<function<void()>> unlistens;
+        unlistens.reserve(n_listeners);
+        {
+            transaction trans;
+            for (int i = 0; i < n_listeners; ++i) {
+                unlistens.push_back(sa.listen([out] (const int& x) { *out += x; }));
+            }
+        }
+        for (auto i = order.begin(); i != order.end(); ++i) {
+            unlistens[*i]();
+        }
+    });
+}
+
+// Copying stream and cell handles, which every combinator does many times.
+static void copy_handles()
+{
+    stream_sink<int> sa;
+    stream<int> s = sa;
+    cell<int> ca(0);
+    bench("handle/copy_stream", 1000000, [&s] () { stream<int> copy = s; });
+    bench("handle/copy_cell", 1000000, [&ca] () { cell<int> copy = ca; });
+}
+
+// 8 threads enqueueing into one sink while the owning thread drains, each
+// send in a transaction of its own.
+static void inbox_8_producers()
+{
+    const int n_producers = 8;
+    const int n_sends = 100000;
+    stream_sink<int> sa;
+    std::shared_ptr<long> out = std::make_shared<long>(0);
+    function<void()> unlisten = sa.listen([out] (const int& x) { *out += x; });
+    std::atomic<bool> go(false);
+    vector<std::thread> producers;
+    for (int i = 0; i < n_producers; ++i) {
+        producers.push_back(std::thread([&sa, &go, n_sends] () {
+            while (!go) {
+            }
+            for (int j = 0; j < n_sends; ++j) {
+                sa.enqueue(1);
+            }
+        }));
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    go = true;
+    long received = 0;
+    while (received < (long)n_producers * n_sends) {
+        received += drain_inbox();
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    for (auto producer = producers.begin(); producer != producers.end(); ++producer) {
+        producer->join();
+    }
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    std::cout << "inbox/8_producers: " << (ns / received) << " ns/op" << std::endl;
+    unlisten();
+    if (*out != (long)n_producers * n_sends) {
+        std::cerr << "inbox/8_producers: " << *out << " of " << received << " sends arrived" << std::endl;
+        std::exit(1);
+    }
+}
+
+int main()
+{
+    chain_10k();
+    collect_cycles();
+    map_chain(1, 1000000);
+    collect_cycles();
+    map_chain(10, 1000000);
+    collect_cycles();
+    map_chain(100, 100000);
+    collect_cycles();
+    fan_out(1000, 1000);
+    collect_cycles();
+    fan_out(10000, 100);
+    collect_cycles();
+    fan_in_256();
+    collect_cycles();
+    route_10k_keys();
+    collect_cycles();
+    send_batch_1k();
+    collect_cycles();
+    accum_counter_1m();
+    collect_cycles();
+    hold_snapshot();
+    collect_cycles();
+    lift_2_to_5();
+    collect_cycles();
+    lift_6();
+    collect_cycles();
+    hold_large_value();
+    collect_cycles();
+    switch_churn();
+    collect_cycles();
+    switch_s_fan_out_10k();
+    collect_cycles();
+    construct_chain_100k();
+    collect_loops_10k();
+    listeners_100k();
+    collect_cycles();
+    copy_handles();
+    collect_cycles();
+    inbox_8_producers();
+    collect_cycles();
+    return 0;
+}
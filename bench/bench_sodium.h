@@ -0,0 +1,33 @@
+#ifndef _BENCH_SODIUM_H_
+#define _BENCH_SODIUM_H_
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+
+/*!
+ * Every call to the global operator new, counted by bench_sodium.cpp.
+ */
+extern std::atomic<unsigned long> allocation_count;
+
+/*!
+ * Runs op once untimed to warm up, then iterations more times, and prints
+ * the mean wall-clock time and heap allocations per call.
+ */
+inline void bench(const std::string& name, unsigned int iterations, const std::function<void()>& op) {
+    op();
+    unsigned long allocations_before = allocation_count;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < iterations; ++i) {
+        op();
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    double allocations = (double)(allocation_count - allocations_before);
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    std::cout << name << ": " << (ns / iterations) << " ns/op, "
+              << (allocations / iterations) << " allocs/op" << std::endl;
+}
+
+#endif
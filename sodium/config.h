@@ -30,6 +30,12 @@
 #define SODIUM_MAKE_TUPLE   std::make_tuple
 #define SODIUM_TUPLE_GET    std::get
 #define SODIUM_FORWARD_LIST std::forward_list
+// Define SODIUM_TRACK_LIVING_NODES to have each context keep the set of its
+// living nodes and a count of node handles, for hunting leaks in a debugger.
+// It costs a hash table update per node, so it is off by default. The node
+// count behind num_nodes() is kept either way. It changes the layout of the
+// context, so the library and its users must agree on it; SODIUM_EXTRA_INCLUDE
+// is a good place to define it.
 #ifndef SODIUM_THROW
 #define SODIUM_THROW(text)  throw std::runtime_error(text)
 #endif
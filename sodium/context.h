@@ -0,0 +1,229 @@
+#ifndef _SODIUM_CONTEXT_H_
+#define _SODIUM_CONTEXT_H_
+
+#include "sodium/impl/sodium_ctx.h"
+#include <array>
+#include <chrono>
+
+namespace sodium {
+
+    /*!
+     * How drain_inbox() groups the sends it takes from the inbox, and how
+     * stream_sink::send_all() groups the values it is given.
+     */
+    enum class drain_mode {
+        /*!
+         * Run the whole batch in one transaction, so sends to a sink with a
+         * combining function are coalesced. A sink without one fires only the
+         * last value it was sent in the batch, and the rest are dropped.
+         */
+        one_transaction,
+        /*!
+         * Run each send in a transaction of its own.
+         */
+        transaction_per_item
+    };
+
+    /*!
+     * How much cycle collection runs when an outermost transaction ends.
+     * Explicit collect_cycles() calls always collect everything.
+     */
+    struct collect_cycles_policy {
+        /*!
+         * If false, cycles are only collected by explicit collect_cycles()
+         * calls.
+         */
+        bool at_end_of_transaction;
+        /*!
+         * Don't collect until at least this many possible roots (nodes whose
+         * reference count dropped without reaching zero) have built up.
+         */
+        unsigned int root_threshold;
+        /*!
+         * Limit the nodes traced per transaction. Roots not reached are
+         * carried over to the next transaction. 0 means no limit.
+         *
+         * The limit is checked between roots, and a root is always traced
+         * to the end once started. A single root that reaches a large
+         * subgraph, such as one big cycle, is still traced in one go, so the
+         * pause is bounded by the largest subgraph reachable from one root,
+         * not by this limit alone.
+         */
+        unsigned int max_node_visits;
+        /*!
+         * Limit the time spent tracing per transaction, as above and with
+         * the same per-root granularity. 0 means no limit.
+         */
+        std::chrono::microseconds max_time;
+
+        collect_cycles_policy()
+        : at_end_of_transaction(true), root_threshold(0), max_node_visits(0), max_time(0) {}
+
+        impl::GcConfig impl() const {
+            impl::GcConfig config;
+            config.collect_at_end_of_transaction = at_end_of_transaction;
+            config.root_threshold = root_threshold;
+            config.max_node_visits = max_node_visits;
+            config.max_time = max_time;
+            return config;
+        }
+    };
+
+    /*!
+     * A snapshot of a context's running totals, for monitoring. Take two
+     * and subtract to get rates.
+     *
+     * The phase times and node_updates_histogram are only kept while
+     * detailed stats are switched on.
+     */
+    struct context_stats {
+        /*!
+         * Outermost transactions run.
+         */
+        unsigned long transactions;
+        /*!
+         * Nodes visited during propagation.
+         */
+        unsigned long node_visits;
+        /*!
+         * Nodes whose update ran because an input fired.
+         */
+        unsigned long node_updates;
+        unsigned long pre_eot_callbacks;
+        unsigned long pre_post_callbacks;
+        unsigned long post_callbacks;
+        std::chrono::nanoseconds pre_eot_time;
+        std::chrono::nanoseconds propagate_time;
+        std::chrono::nanoseconds pre_post_time;
+        std::chrono::nanoseconds reset_time;
+        std::chrono::nanoseconds post_time;
+        /*!
+         * Transactions by the number of node updates they ran: bucket 0
+         * counts those with none, bucket i those with 2^(i-1) up to 2^i - 1.
+         */
+        std::array<unsigned long, 32> node_updates_histogram;
+        /*!
+         * The number of nodes alive now.
+         */
+        int num_nodes;
+        /*!
+         * Cycle collection passes run.
+         */
+        unsigned long collections;
+        /*!
+         * Nodes buffered as possible roots of a cycle so far, and those
+         * buffered now waiting for the next collection.
+         */
+        unsigned long roots_buffered;
+        unsigned int roots_pending;
+        /*!
+         * Nodes freed, and of those, how many the cycle collector freed.
+         */
+        unsigned long nodes_freed;
+        unsigned long nodes_collected;
+        /*!
+         * Nodes visited by the cycle collector.
+         */
+        unsigned long collect_node_visits;
+        std::chrono::nanoseconds collect_time;
+
+        context_stats(const impl::SodiumCtx& sodium_ctx) {
+            const impl::SodiumStats& stats = sodium_ctx.stats();
+            transactions = stats.transactions;
+            node_visits = stats.node_visits;
+            node_updates = stats.node_updates;
+            pre_eot_callbacks = stats.pre_eot_callbacks;
+            pre_post_callbacks = stats.pre_post_callbacks;
+            post_callbacks = stats.post_callbacks;
+            pre_eot_time = stats.pre_eot_time;
+            propagate_time = stats.propagate_time;
+            pre_post_time = stats.pre_post_time;
+            reset_time = stats.reset_time;
+            post_time = stats.post_time;
+            node_updates_histogram = stats.node_updates_histogram;
+            num_nodes = sodium_ctx.num_nodes();
+            const impl::GcStats& gc_stats = sodium_ctx.gc_ctx().stats();
+            collections = gc_stats.collections;
+            roots_buffered = gc_stats.roots_buffered;
+            roots_pending = sodium_ctx.gc_ctx().roots_pending();
+            nodes_freed = gc_stats.nodes_freed;
+            nodes_collected = gc_stats.nodes_collected;
+            collect_node_visits = gc_stats.node_visits;
+            collect_time = gc_stats.collect_time;
+        }
+    };
+
+    /*!
+     * An independent FRP graph. Streams and cells created in one context
+     * share no mutable state with those in any other, so separate contexts
+     * can be driven from separate threads at the same time. Each context
+     * must only be used by one thread at a time.
+     *
+     * Without a context_scope, each thread uses a context of its own.
+     */
+    class context
+    {
+        private:
+            impl::SodiumCtx impl_;
+
+        public:
+            context() {}
+
+            impl::SodiumCtx& impl() { return impl_; }
+
+            /*!
+             * Free any unreachable cycles of nodes in this context.
+             */
+            void collect_cycles() { impl_.collect_cycles(); }
+
+            void set_collect_cycles_policy(const collect_cycles_policy& policy) {
+                impl_.gc_ctx().set_config(policy.impl());
+            }
+
+            /*!
+             * The number of nodes alive in this context.
+             */
+            int num_nodes() const { return impl_.num_nodes(); }
+
+            /*!
+             * Run the sends queued with stream_sink::enqueue() so far. Must be
+             * called on the thread that uses this context. Returns the number
+             * of sends run. By default each send gets a transaction of its
+             * own, so none are lost; drain_mode::one_transaction is for sinks
+             * with a combining function.
+             */
+            unsigned int drain_inbox(drain_mode mode = drain_mode::transaction_per_item) {
+                return impl_.drain_inbox(mode == drain_mode::transaction_per_item);
+            }
+
+            void reset_num_nodes() { impl_.reset_num_nodes(); }
+
+            context_stats stats() const { return context_stats(impl_); }
+
+            /*!
+             * Switch on or off the per-phase times and histogram in stats(),
+             * which cost a few clock reads per transaction.
+             */
+            void set_detailed_stats(bool detailed) { impl_.set_detailed_stats(detailed); }
+    };
+
+    /*!
+     * Makes a context the current one for this thread until the scope ends,
+     * so that sinks, loops, constant cells and transactions created without
+     * an explicit context use it.
+     */
+    class context_scope
+    {
+        private:
+            impl::SodiumCtxScope impl_;
+            // Disallow copying
+            context_scope(const context_scope&);
+            // Disallow copying
+            context_scope& operator = (const context_scope&);
+
+        public:
+            context_scope(context& ctx): impl_(ctx.impl()) {}
+    };
+}
+
+#endif
@@ -65,6 +65,8 @@ public:
 
     A& sample() const;
 
+    std::shared_ptr<const A> sample_ptr() const;
+
     Lazy<A> sample_lazy() const;
 
     Stream<A> updates() const;
@@ -100,6 +102,13 @@ public:
     Listener listen(K k) const;
 };
 
+/**
+ * Lifts an N-ary function into cells with a single node. Simultaneous updates
+ * to several inputs call the function once.
+ */
+template <typename FN, typename... AS>
+Cell<typename std::result_of<FN(const AS&...)>::type> lift_n(FN fn, const Cell<AS>&... cells);
+
 template <typename A>
 class WeakCell {
 public:
@@ -2,6 +2,7 @@
 #define __SODIUM_IMPL_CELL_IMPL_H__
 
 #include <tuple>
+#include <type_traits>
 #include <utility>
 
 #include <boost/optional.hpp>
@@ -22,11 +23,24 @@ class CellData {
 public:
     Stream<A> stream;
     Lazy<std::shared_ptr<A>> value;
-    boost::optional<std::shared_ptr<A>> next_value_op;
+    // Whether the hold has a new value waiting to be published this
+    // transaction.
+    bool publishing;
 
-    CellData(Stream<A> stream, Lazy<std::shared_ptr<A>> value, boost::optional<std::shared_ptr<A>> next_value_op)
-    : stream(stream), value(value), next_value_op(next_value_op)
+    CellData(Stream<A> stream, Lazy<std::shared_ptr<A>> value)
+    : stream(stream), value(value), publishing(false)
     {}
+
+    /**
+     * Replaces the value by swapping the pointer in place, so publishing
+     * neither copies the value nor allocates. Values are never changed once
+     * published, so anyone still holding the old one keeps seeing it.
+     */
+    void publish(std::shared_ptr<A> value) {
+        LazyData<std::shared_ptr<A>>& data = *this->value.data;
+        data.thunk_op = boost::none;
+        data.value_op = std::move(value);
+    }
 };
 
 template <typename A>
@@ -52,16 +66,12 @@ Cell<A>::Cell(const Cell<A>& ca): data(ca.data), _node(ca._node) {}
 
 template <typename A>
 Cell<A> Cell<A>::mkConstCell(SodiumCtx& sodium_ctx, A&& value) {
-    std::shared_ptr<CellData<A>> cell_data;
-    {
-        std::shared_ptr<A> value2 = std::unique_ptr<A>(new A(std::move(value)));
-        CellData<A>* _cell_data = new CellData<A>(
-            Stream<A>(sodium_ctx),
-            Lazy<std::shared_ptr<A>>::of_value(value2),
-            boost::none
-        );
-        cell_data = std::unique_ptr<CellData<A>>(_cell_data);
-    }
+    std::shared_ptr<A> value2 = std::unique_ptr<A>(new A(std::move(value)));
+    std::shared_ptr<CellData<A>> cell_data = slab_make_shared<CellData<A>>(
+        sodium_ctx.slab(),
+        Stream<A>(sodium_ctx),
+        Lazy<std::shared_ptr<A>>::of_value(value2)
+    );
     return Cell<A>(
         cell_data,
         Node::mk_node(
@@ -76,12 +86,11 @@ Cell<A> Cell<A>::mkConstCell(SodiumCtx& sodium_ctx, A&& value) {
 template <typename A>
 Cell<A> Cell<A>::mkCell(SodiumCtx& sodium_ctx, Stream<A> stream, Lazy<A> value) {
     Lazy<std::shared_ptr<A>> init_value = Lazy<std::shared_ptr<A>>([value]() mutable { return std::shared_ptr<A>(std::unique_ptr<A>(new A(value.move()))); });
-    std::shared_ptr<CellData<A>> cell_data =
-        std::unique_ptr<CellData<A>>(new CellData<A>(
-            stream,
-            init_value,
-            boost::none
-        ));
+    std::shared_ptr<CellData<A>> cell_data = slab_make_shared<CellData<A>>(
+        sodium_ctx.slab(),
+        stream,
+        init_value
+    );
     CellWeakForwardRef<A> c_forward_ref;
     std::vector<std::unique_ptr<IsNode>> dependencies;
     dependencies.push_back(stream.box_clone());
@@ -90,18 +99,14 @@ Cell<A> Cell<A>::mkCell(SodiumCtx& sodium_ctx, Stream<A> stream, Lazy<A> value)
         "Cell::hold",
         [sodium_ctx, stream, c_forward_ref]() mutable {
             Cell<A> c = c_forward_ref.unwrap();
-            if (stream.data->firing_op) {
-                std::shared_ptr<A>& firing = *stream.data->firing_op;
-                bool is_first = !c.data->next_value_op;
-                c.data->next_value_op = boost::optional<std::shared_ptr<A>>(firing);
-                if (is_first) {
-                    sodium_ctx.post([c]() {
-                        if (c.data->next_value_op) {
-                            c.data->value = Lazy<std::shared_ptr<A>>::of_value(*c.data->next_value_op);
-                            c.data->next_value_op = boost::none;
-                        }
-                    });
-                }
+            if (stream.data->firing_op && !c.data->publishing) {
+                c.data->publishing = true;
+                // Once every node has seen the firing, move it out and share
+                // it with the stream's other holds rather than copying it.
+                sodium_ctx.pre_post([c, stream]() {
+                    c.data->publish(stream.data->publish());
+                    c.data->publishing = false;
+                });
             }
         },
         std::move(dependencies)
@@ -139,6 +144,12 @@ A& Cell<A>::sample() const {
     return **this->data->value;
 }
 
+template <typename A>
+std::shared_ptr<const A> Cell<A>::sample_ptr() const {
+    const Lazy<std::shared_ptr<A>>& value = this->data->value;
+    return *value;
+}
+
 template <typename A>
 Lazy<A> Cell<A>::sample_lazy() const {
     Cell<A> this_ = *this;
@@ -161,7 +172,7 @@ Stream<A> Cell<A>::value() const {
         const Lazy<std::shared_ptr<A>>& fire = this_.data->value;
         Node node = spark.node();
         node.data->changed = true;
-        sodium_ctx.data->changed_nodes.push_back(spark.box_clone());
+        sodium_ctx.data->changed_nodes.push_back(spark.node().data);
         sodium_ctx.pre_eot([spark,fire]() mutable {
             spark._send(**fire);
         });
@@ -178,120 +189,123 @@ Cell<typename std::result_of<FN(const A&)>::type> Cell<A>::map(FN fn) const {
     return this->updates().map(fn).hold_lazy(init);
 }
 
+/**
+ * The state of a lift_n() node. Each input is passed to the function by
+ * reference, from its firing if it fired this transaction and otherwise from
+ * its cell, so lifting never copies the inputs.
+ */
+template <typename FN, typename... AS>
+struct LiftNState {
+    typedef typename std::result_of<FN(const AS&...)>::type R;
+
+    std::tuple<Cell<AS>...> cells;
+    std::tuple<Stream<AS>...> updates;
+    FN fn;
+
+    LiftNState(FN fn, const Cell<AS>&... cells): cells(cells...), updates(cells.updates()...), fn(fn) {}
+
+    template <std::size_t... IS>
+    std::vector<std::unique_ptr<IsNode>> dependencies(std::index_sequence<IS...>) const {
+        std::vector<std::unique_ptr<IsNode>> dependencies;
+        int unused[] = { 0, (dependencies.push_back(std::get<IS>(this->updates).box_clone()), 0)... };
+        (void)unused;
+        return dependencies;
+    }
+
+    template <std::size_t... IS>
+    std::vector<Dep> deps(std::index_sequence<IS...>) const {
+        return std::vector<Dep>({ std::get<IS>(this->updates).to_dep()..., std::get<IS>(this->cells).to_dep()... });
+    }
+
+    template <std::size_t... IS>
+    bool any_fired(std::index_sequence<IS...>) const {
+        bool any_fired = false;
+        int unused[] = { 0, (any_fired = any_fired || (bool)std::get<IS>(this->updates).data->firing_op, 0)... };
+        (void)unused;
+        return any_fired;
+    }
+
+    /**
+     * The input's value as of this transaction. A cell is not updated until
+     * the end of the transaction, so an input that fired is read from its
+     * firing.
+     */
+    template <std::size_t I>
+    const typename std::tuple_element<I, std::tuple<AS...>>::type& input() const {
+        auto& firing_op = std::get<I>(this->updates).data->firing_op;
+        if (firing_op) {
+            return *firing_op;
+        }
+        return std::get<I>(this->cells).sample();
+    }
+
+    template <std::size_t... IS>
+    R call(std::index_sequence<IS...>) const {
+        return this->fn(this->template input<IS>()...);
+    }
+
+    template <std::size_t... IS>
+    R call_sampled(std::index_sequence<IS...>) const {
+        return this->fn(std::get<IS>(this->cells).sample()...);
+    }
+};
+
+template <typename FN, typename... AS>
+Cell<typename std::result_of<FN(const AS&...)>::type> lift_n(FN fn, const Cell<AS>&... cells) {
+    typedef typename std::result_of<FN(const AS&...)>::type R;
+    typedef std::index_sequence_for<AS...> INDICES;
+    std::vector<Dep> fn_deps = GetDeps<FN>::call(fn);
+    std::shared_ptr<LiftNState<FN, AS...>> state = std::make_shared<LiftNState<FN, AS...>>(fn, cells...);
+    SodiumCtx sodium_ctx = std::get<0>(state->cells).sodium_ctx();
+    Stream<R> s = Stream<R>::mkStream(
+        sodium_ctx,
+        [sodium_ctx, state, fn_deps](StreamWeakForwardRef<R> s) {
+            Node node = Node::mk_node(
+                sodium_ctx,
+                "Cell::lift_n",
+                [state, s]() {
+                    if (state->any_fired(INDICES())) {
+                        s.send(state->call(INDICES()));
+                    }
+                },
+                state->dependencies(INDICES())
+            );
+            node.add_update_dependencies(state->deps(INDICES()));
+            node.add_update_dependencies(fn_deps);
+            return node;
+        }
+    );
+    return s.hold_lazy(Lazy<R>([state]() { return state->call_sampled(INDICES()); }));
+}
+
 template <typename A>
 template <typename B, typename FN>
 Cell<typename std::result_of<FN(const A&, const B&)>::type> Cell<A>::lift2(const Cell<B>& cb, FN fn) const {
-    typedef typename std::result_of<FN(const A&, const B&)>::type C;
-    std::vector<Dep> fn_deps = GetDeps<FN>::call(fn);
-    Cell<A> ca = *this;
-    Lazy<A> lhs = ca.sample_lazy();
-    Lazy<B> rhs = cb.sample_lazy();
-    Lazy<C> init([lhs,rhs,fn]() {
-        return fn(*lhs,*rhs);
-    });
-    std::shared_ptr<std::pair<Lazy<A>,Lazy<B>>> state =
-        std::unique_ptr<std::pair<Lazy<A>,Lazy<B>>>(
-            new std::pair<Lazy<A>,Lazy<B>>(
-                lhs,
-                rhs
-            )
-        );
-    Stream<unit> s1 =
-        this->updates().map([state](const A& a) {
-            state->first = Lazy<A>::of_value(a);
-            return unit();
-        });
-    Stream<unit> s2 =
-        cb.updates().map([state](const B& b) {
-            state->second = Lazy<B>::of_value(b);
-            return unit();
-        });
-    Stream<C> s = s1.or_else(s2).map(lambda1([state, fn](const unit& _) {
-        return fn(*state->first, *state->second);
-    }).append_vec_deps(fn_deps));
-    return s.hold_lazy(init);
+    return lift_n(fn, *this, cb);
 }
 
 template <typename A>
 template <typename B, typename C, typename FN>
 Cell<typename std::result_of<FN(const A&, const B&, const C&)>::type> Cell<A>::lift3(const Cell<B>& cb, const Cell<C>& cc, FN fn) const {
-    std::vector<Dep> fn_deps = GetDeps<FN>::call(fn);
-    return this
-        ->lift2(
-            cb,
-            [](const A& a, const B& b) {
-                return std::pair<A,B>(a,b);
-            }
-        )
-        .lift2(
-            cc,
-            lambda2([fn](const std::pair<A,B>& ab, const C& c) {
-                return fn(ab.first, ab.second, c);
-            }).append_vec_deps(fn_deps)
-        );
+    return lift_n(fn, *this, cb, cc);
 }
 
 template <typename A>
 template <typename B, typename C, typename D, typename FN>
 Cell<typename std::result_of<FN(const A&, const B&, const C&, const D&)>::type> Cell<A>::lift4(const Cell<B>& cb, const Cell<C>& cc, const Cell<D>& cd, FN fn) const {
-    std::vector<Dep> fn_deps = GetDeps<FN>::call(fn);
-    return this
-        ->lift3(
-            cb,
-            cc,
-            [](const A& a, const B& b, const C& c) {
-                return std::tuple<A,B,C>(a, b, c);
-            }
-        )
-        .lift2(
-            cd,
-            lambda2([fn](const std::tuple<A,B,C>& abc, const D& d) {
-                return fn(std::get<0>(abc), std::get<1>(abc), std::get<2>(abc), d);
-            }).append_vec_deps(fn_deps)
-        );
+    return lift_n(fn, *this, cb, cc, cd);
 }
 
 template <typename A>
 template <typename B, typename C, typename D, typename E, typename FN>
 Cell<typename std::result_of<FN(const A&, const B&, const C&, const D&, const E&)>::type> Cell<A>::lift5(const Cell<B>& cb, const Cell<C>& cc, const Cell<D>& cd, const Cell<E>& ce, FN fn) const {
-    std::vector<Dep> fn_deps = GetDeps<FN>::call(fn);
-    return this
-        ->lift3(
-            cb,
-            cc,
-            [](const A& a, const B& b, const C& c) {
-                return std::tuple<A,B,C>(a, b, c);
-            }
-        )
-        .lift3(
-            cd,
-            ce,
-            lambda3([fn](const std::tuple<A,B,C>& abc, const D& d, const E& e) {
-                return fn(std::get<0>(abc), std::get<1>(abc), std::get<2>(abc), d, e);
-            }).append_vec_deps(fn_deps)
-        );
+    return lift_n(fn, *this, cb, cc, cd, ce);
 }
 
 template <typename A>
 template <typename B, typename C, typename D, typename E, typename F, typename FN>
 Cell<typename std::result_of<FN(const A&, const B&, const C&, const D&, const E&, const F&)>::type> Cell<A>::lift6(const Cell<B>& cb, const Cell<C>& cc, const Cell<D>& cd, const Cell<E>& ce, const Cell<F>& cf, FN fn) const {
-    std::vector<Dep> fn_deps = GetDeps<FN>::call(fn);
-    return this
-        ->lift4(
-            cb,
-            cc,
-            cd,
-            [](const A& a, const B& b, const C& c, const D& d) {
-                return std::tuple<A,B,C,D>(a, b, c, d);
-            }
-        )
-        .lift3(
-            ce,
-            cf,
-            lambda3([fn](const std::tuple<A,B,C,D>& abcd, const E& e, const F& f) {
-                return fn(std::get<0>(abcd), std::get<1>(abcd), std::get<2>(abcd), std::get<3>(abcd), e, f);
-            }).append_vec_deps(fn_deps)
-        );
+    return lift_n(fn, *this, cb, cc, cd, ce, cf);
 }
 
 template <typename A>
@@ -310,8 +324,8 @@ Stream<A> Cell<A>::switch_s(const Cell<Stream<A>>& csa) {
                 [inner_s, sa]() {
                     Stream<A> inner_s2 = *std::get<0>(*inner_s).upgrade2();
                     if (inner_s2.data->firing_op) {
-                        A& firing = **inner_s2.data->firing_op;
-                        sa.unwrap()._send(firing);
+                        A& firing = *inner_s2.data->firing_op;
+                        sa.send(firing);
                     }
                 },
                 std::vector<std::unique_ptr<IsNode>>()
@@ -328,7 +342,7 @@ Stream<A> Cell<A>::switch_s(const Cell<Stream<A>>& csa) {
                 "switch_s outer node",
                 [sodium_ctx, inner_s, node1, csa_updates]() mutable {
                     if (csa_updates.data->firing_op) {
-                        Stream<A>& firing = **csa_updates.data->firing_op;
+                        Stream<A>& firing = *csa_updates.data->firing_op;
                         sodium_ctx.pre_post([node1, inner_s, firing]() mutable {
                             Stream<A> inner_s2 = *std::get<0>(*inner_s).upgrade2();
                             node1.remove_dependency(inner_s2);
@@ -378,20 +392,19 @@ Cell<A> Cell<A>::switch_c(const Cell<Cell<A>>& cca) {
                 std::move(node2_deps)
             );
             std::function<void()> node1_update = [sodium_ctx, cca, last_inner_s, node1, node2, sa]() mutable {
-                boost::optional<std::shared_ptr<Cell<A>>>& firing_op = cca.updates().data->firing_op;
+                boost::optional<Cell<A>>& firing_op = cca.updates().data->firing_op;
                 if (firing_op) {
-                    Cell<A>& firing = **firing_op;
+                    Cell<A>& firing = *firing_op;
                     // will be overwriten by node2 firing if there is one
                     sodium_ctx.update_node(firing.updates().node());
-                    Stream<A> sa2 = sa.unwrap();
-                    sa2._send(firing.sample());
+                    sa.send(firing.sample());
                     //
                     node1.data->changed = true;
                     node2.data->changed = true;
                     Stream<A> new_inner_s = firing.updates();
                     if (new_inner_s.data->firing_op) {
-                        A& firing2 = **new_inner_s.data->firing_op;
-                        sa2._send(firing2);
+                        A& firing2 = *new_inner_s.data->firing_op;
+                        sa.send(firing2);
                     }
                     WeakStream<A>& last_inner_s2 = std::get<0>(*last_inner_s);
                     node2.remove_dependency(*last_inner_s2.upgrade2());
@@ -407,8 +420,8 @@ Cell<A> Cell<A>::switch_c(const Cell<Cell<A>>& cca) {
                 WeakStream<A>& last_inner_s2 = std::get<0>(*last_inner_s);
                 Stream<A> last_inner_s3 = *last_inner_s2.upgrade2();
                 if (last_inner_s3.data->firing_op) {
-                    A& firing = **last_inner_s3.data->firing_op;
-                    sa.unwrap()._send(firing);
+                    A& firing = *last_inner_s3.data->firing_op;
+                    sa.send(firing);
                 }
             };
             node2.data->update = node2_update;
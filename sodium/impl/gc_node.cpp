@@ -7,6 +7,7 @@ using namespace sodium::impl;
 GcCtx::GcCtx() {
     GcCtxData* data = new GcCtxData();
     data->next_id = 0;
+    data->slab = std::make_shared<Slab>();
     this->data = std::unique_ptr<GcCtxData>(data);
 }
 
@@ -18,24 +19,95 @@ unsigned int GcCtx::make_id() {
 
 void GcCtx::add_possible_root(const GcNode& node) const {
     this->data->roots.push_back(node);
+    ++this->data->stats.roots_buffered;
 }
 
 void GcCtx::collect_cycles() const {
     do {
-        this->mark_roots();
-        this->scan_roots();
-        this->collect_roots();
+        this->collect_cycles_bounded(0, std::chrono::microseconds(0));
     } while (this->data->roots.size() != 0);
 }
 
-void GcCtx::mark_roots() const {
-    std::vector<GcNode> old_roots;
+void GcCtx::collect_cycles_at_end_of_transaction() const {
+    const GcConfig& config = this->data->config;
+    if (!config.collect_at_end_of_transaction) {
+        return;
+    }
+    if (this->data->roots.size() == 0 || this->data->roots.size() < config.root_threshold) {
+        return;
+    }
+    if (config.max_node_visits == 0 && config.max_time.count() == 0) {
+        this->collect_cycles();
+        return;
+    }
+    // Only one pass: roots buffered by nodes freed in this pass, along with
+    // any deferred ones, wait for the next transaction.
+    this->collect_cycles_bounded(config.max_node_visits, config.max_time);
+}
+
+const GcConfig& GcCtx::config() const {
+    return this->data->config;
+}
+
+void GcCtx::set_config(const GcConfig& config) const {
+    this->data->config = config;
+}
+
+const GcStats& GcCtx::stats() const {
+    return this->data->stats;
+}
+
+unsigned int GcCtx::roots_pending() const {
+    return this->data->roots.size();
+}
+
+void GcCtx::collect_cycles_bounded(unsigned int max_node_visits, std::chrono::microseconds max_time) const {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    this->mark_roots(max_node_visits, max_time);
+    this->scan_roots();
+    this->collect_roots();
+    GcStats& stats = this->data->stats;
+    ++stats.collections;
+    stats.node_visits += this->data->node_visits;
+    stats.collect_time += std::chrono::steady_clock::now() - start;
+    // Put the roots we did not get to in front of any new ones, so that
+    // they are the first to be marked next time.
+    std::vector<GcNode>& deferred_roots = this->data->deferred_roots;
+    if (deferred_roots.size() != 0) {
+        std::vector<GcNode>& roots = this->data->roots;
+        deferred_roots.insert(deferred_roots.end(), roots.begin(), roots.end());
+        roots.clear();
+        roots.swap(deferred_roots);
+    }
+}
+
+void GcCtx::mark_roots(unsigned int max_node_visits, std::chrono::microseconds max_time) const {
+    std::vector<GcNode>& old_roots = this->data->old_roots;
     old_roots.swap(this->data->roots);
-    std::vector<GcNode> new_roots;
+    std::vector<GcNode>& new_roots = this->data->roots;
+    this->data->node_visits = 0;
+    bool timed = max_time.count() != 0;
+    std::chrono::steady_clock::time_point start;
+    if (timed) {
+        start = std::chrono::steady_clock::now();
+    }
+    bool out_of_budget = false;
     for (auto root = old_roots.begin(); root != old_roots.end(); ++root) {
         if (root->data->color == Color::Purple) {
+            if (out_of_budget) {
+                // Stays buffered and purple until a later collection.
+                this->data->deferred_roots.push_back(*root);
+                continue;
+            }
             this->mark_gray(*root);
             new_roots.push_back(*root);
+            // At least one root is always marked, so every collection makes
+            // progress.
+            if (max_node_visits != 0 && this->data->node_visits >= max_node_visits) {
+                out_of_budget = true;
+            } else if (timed && std::chrono::steady_clock::now() - start >= max_time) {
+                out_of_budget = true;
+            }
         } else {
             root->data->buffered = false;
             if (root->data->color == Color::Black && root->data->ref_count == 0 && !root->data->freed) {
@@ -43,19 +115,36 @@ void GcCtx::mark_roots() const {
             }
         }
     }
-    this->data->roots.swap(new_roots);
+    old_roots.clear();
 }
 
+// The phases below walk the graph with explicit work stacks rather than by
+// recursion, so that long chains of nodes cannot overflow the call stack.
+// Each phase builds one tracer that pushes onto its stack and reuses it for
+// every node it visits.
+
 void GcCtx::mark_gray(GcNode& s) const {
     if (s.data->color == Color::Gray) {
         return;
     }
-    s.data->color = Color::Gray;
-
-    s.trace([this](GcNode& t) {
+    std::vector<GcNodeData*>& stack = this->data->stack;
+    std::function<Tracer> tracer = [&stack](GcNode& t) {
         t.data->ref_count_adj = t.data->ref_count_adj + 1;
-        this->mark_gray(t);
-    });
+        if (t.data->color != Color::Gray) {
+            stack.push_back(t.data.get());
+        }
+    };
+    stack.push_back(s.data.get());
+    while (stack.size() != 0) {
+        GcNodeData* node = stack.back();
+        stack.pop_back();
+        if (node->color == Color::Gray) {
+            continue;
+        }
+        node->color = Color::Gray;
+        this->data->node_visits = this->data->node_visits + 1;
+        (node->trace)(tracer);
+    }
 }
 
 void GcCtx::scan_roots() const {
@@ -63,44 +152,79 @@ void GcCtx::scan_roots() const {
     for (auto root = roots.begin(); root != roots.end(); ++root) {
         this->scan(*root);
     }
-    for (auto root = roots.begin(); root != roots.end(); ++root) {
-        this->reset_ref_count_adj(*root);
-    }
+    this->reset_ref_count_adj();
 }
 
 void GcCtx::scan(GcNode& s) const {
-    if (s.data->color != Color::Gray) {
-        return;
-    }
-    if (s.data->ref_count_adj == s.data->ref_count) {
-        s.data->color = Color::White;
-        s.trace([this](GcNode& t) {
-            this->scan(t);
-        });
-    } else {
-        this->scan_black(s);
+    std::vector<GcNodeData*>& stack = this->data->stack;
+    std::function<Tracer> tracer = [&stack](GcNode& t) {
+        if (t.data->color == Color::Gray) {
+            stack.push_back(t.data.get());
+        }
+    };
+    stack.push_back(s.data.get());
+    while (stack.size() != 0) {
+        GcNodeData* node = stack.back();
+        stack.pop_back();
+        if (node->color != Color::Gray) {
+            continue;
+        }
+        if (node->ref_count_adj == node->ref_count) {
+            node->color = Color::White;
+            (node->trace)(tracer);
+        } else {
+            this->scan_black(node);
+        }
     }
 }
 
-void GcCtx::scan_black(GcNode& s) const {
-    s.data->color = Color::Black;
-    s.trace([this](GcNode& t) {
+void GcCtx::scan_black(GcNodeData* s) const {
+    std::vector<GcNodeData*>& stack = this->data->black_stack;
+    std::function<Tracer> tracer = [&stack](GcNode& t) {
         if (t.data->color != Color::Black) {
-            this->scan_black(t);
+            stack.push_back(t.data.get());
+        }
+    };
+    s->color = Color::Black;
+    (s->trace)(tracer);
+    while (stack.size() != 0) {
+        GcNodeData* node = stack.back();
+        stack.pop_back();
+        if (node->color == Color::Black) {
+            continue;
         }
-    });
+        node->color = Color::Black;
+        (node->trace)(tracer);
+    }
 }
 
-void GcCtx::reset_ref_count_adj(GcNode& s) const {
-    if (s.data->visited) {
-        return;
+void GcCtx::reset_ref_count_adj() const {
+    std::vector<GcNodeData*>& stack = this->data->stack;
+    std::vector<GcNodeData*>& visited = this->data->visited;
+    std::function<Tracer> tracer = [&stack](GcNode& t) {
+        if (!t.data->visited) {
+            stack.push_back(t.data.get());
+        }
+    };
+    std::vector<GcNode>& roots = this->data->roots;
+    for (auto root = roots.begin(); root != roots.end(); ++root) {
+        stack.push_back(root->data.get());
+        while (stack.size() != 0) {
+            GcNodeData* node = stack.back();
+            stack.pop_back();
+            if (node->visited) {
+                continue;
+            }
+            node->visited = true;
+            node->ref_count_adj = 0;
+            visited.push_back(node);
+            (node->trace)(tracer);
+        }
+    }
+    for (auto node = visited.begin(); node != visited.end(); ++node) {
+        (*node)->visited = false;
     }
-    s.data->visited = true;
-    s.data->ref_count_adj = 0;
-    s.trace([this](GcNode& t) {
-        this->reset_ref_count_adj(t);
-    });
-    s.data->visited = false;
+    visited.clear();
 }
 
 void GcCtx::collect_roots() const {
@@ -114,6 +238,7 @@ void GcCtx::collect_roots() const {
     for (auto i = white.begin(); i != white.end(); ++i) {
         if (!i->data->freed) {
             i->free();
+            ++this->data->stats.nodes_collected;
         }
     }
     std::vector<GcNode> to_be_freed;
@@ -123,18 +248,48 @@ void GcCtx::collect_roots() const {
             i->free();
         }
     }
+    // Hand the buffer back so that buffering roots in the next transaction
+    // does not have to allocate it again.
+    roots.clear();
+    if (this->data->roots.size() == 0) {
+        roots.swap(this->data->roots);
+    }
 }
 
 void GcCtx::collect_white(GcNode& s, std::vector<GcNode>& white) const {
-    if (s.data->color == Color::White) {
-        s.data->color = Color::Black;
-        s.trace([this, &white](GcNode& t) {
-            this->collect_white(t, white);
-        });
+    if (s.data->color != Color::White) {
+        return;
     }
+    // Holds GcNode copies rather than raw pointers, as the nodes collected
+    // here are freed (and may release each other) once the walk is done.
+    std::vector<GcNode>& stack = this->data->white_stack;
+    std::function<Tracer> tracer = [&stack](GcNode& t) {
+        if (t.data->color == Color::White) {
+            stack.push_back(t);
+        }
+    };
+    stack.push_back(s);
+    while (stack.size() != 0) {
+        GcNode node = stack.back();
+        stack.pop_back();
+        if (node.data->color != Color::White) {
+            continue;
+        }
+        node.data->color = Color::Black;
+        white.push_back(node);
+        node.trace(tracer);
+    }
+}
+
+GcCtxData::GcCtxData(): next_id(0), node_visits(0), deconstructing(false) {
+}
+
+unsigned int GcNode::id() const {
+    return this->data->id;
 }
 
-GcCtxData::GcCtxData(): next_id(0) {
+const char* GcNode::name() const {
+    return this->data->name;
 }
 
 unsigned int GcNode::ref_count() const {
@@ -173,15 +328,38 @@ void GcNode::possible_root() const {
         this->data->color = Color::Purple;
         if (!this->data->buffered) {
             this->data->buffered = true;
-            this->gc_ctx.add_possible_root(*this);
+            this->data->gc_ctx_data->roots.push_back(*this);
+            ++this->data->gc_ctx_data->stats.roots_buffered;
         }
     }
 }
 
 void GcNode::free() const {
+    if (this->data->freed) {
+        return;
+    }
     this->data->freed = true;
-    std::function<Deconstructor> deconstructor = []() {};
-    std::swap(deconstructor, this->data->deconstructor);
-    deconstructor();
-    this->data->trace = [](std::function<Tracer>& tracer) {};
+    // Deconstructors release references, which frees further nodes. Queue
+    // those up and run them from the outermost free() instead of recursing,
+    // so dropping a long chain does not overflow the stack.
+    GcCtxData& gc_ctx_data = *this->data->gc_ctx_data;
+    ++gc_ctx_data.stats.nodes_freed;
+    gc_ctx_data.to_deconstruct.push_back(*this);
+    if (gc_ctx_data.deconstructing) {
+        return;
+    }
+    gc_ctx_data.deconstructing = true;
+    while (gc_ctx_data.to_deconstruct.size() != 0) {
+        std::shared_ptr<GcNodeData> data = gc_ctx_data.to_deconstruct.back().data;
+        gc_ctx_data.to_deconstruct.pop_back();
+        std::function<Deconstructor> deconstructor = []() {};
+        std::swap(deconstructor, data->deconstructor);
+        deconstructor();
+        data->trace = [](std::function<Tracer>&) {};
+    }
+    gc_ctx_data.deconstructing = false;
+}
+
+void GcNode::trace(std::function<Tracer>& tracer) const {
+    (this->data->trace)(tracer);
 }
@@ -1,11 +1,13 @@
 #ifndef __SODIUM_CXX_IMPL_GC_NODE_H__
 #define __SODIUM_CXX_IMPL_GC_NODE_H__
 
+#include <chrono>
 #include <functional>
 #include <memory>
-#include <string>
 #include <vector>
 
+#include "sodium/impl/slab.h"
+
 namespace sodium {
 
 namespace impl {
@@ -26,9 +28,54 @@ typedef enum Color {
     White
 } Color;
 
+/**
+ * Decides how much cycle collection is done at the end of each outermost
+ * transaction. collect_cycles() always runs a full collection regardless.
+ */
+typedef struct GcConfig {
+    // If false, cycles are only collected by explicit collect_cycles() calls.
+    bool collect_at_end_of_transaction;
+    // Skip collecting at the end of a transaction until at least this many
+    // possible roots are buffered.
+    unsigned int root_threshold;
+    // Stop marking further roots once this many nodes have been visited. The
+    // roots left over are kept for the next transaction. 0 means no limit.
+    // The limit is checked between roots, and the root being marked is always
+    // finished, so one pass can still visit everything reachable from a
+    // single root: the bound is per root, not per graph.
+    unsigned int max_node_visits;
+    // As max_node_visits, but bounded by time, with the same per-root
+    // granularity. 0 means no limit.
+    std::chrono::microseconds max_time;
+
+    GcConfig(): collect_at_end_of_transaction(true), root_threshold(0), max_node_visits(0), max_time(0) {}
+} GcConfig;
+
+/**
+ * Running totals kept by a GcCtx, for monitoring.
+ */
+typedef struct GcStats {
+    // Passes of the collector over the buffered roots.
+    unsigned long collections;
+    // Nodes buffered as possible roots of a cycle.
+    unsigned long roots_buffered;
+    // Nodes freed, whether their count reached zero or they were collected.
+    unsigned long nodes_freed;
+    // Of nodes_freed, those freed by the collector as part of a cycle.
+    unsigned long nodes_collected;
+    // Nodes visited while marking.
+    unsigned long node_visits;
+    std::chrono::nanoseconds collect_time;
+
+    GcStats(): collections(0), roots_buffered(0), nodes_freed(0), nodes_collected(0), node_visits(0), collect_time(0) {}
+} GcStats;
+
 struct GcCtxData;
 typedef struct GcCtxData GcCtxData;
 
+struct GcNodeData;
+typedef struct GcNodeData GcNodeData;
+
 typedef struct GcCtx {
     std::shared_ptr<GcCtxData> data;
 
@@ -40,9 +87,28 @@ typedef struct GcCtx {
 
     void collect_cycles() const;
 
+    /**
+     * Called at the end of each outermost transaction. Collects according to
+     * the GcConfig, possibly only part of the buffered roots.
+     */
+    void collect_cycles_at_end_of_transaction() const;
+
+    const GcConfig& config() const;
+
+    void set_config(const GcConfig& config) const;
+
+    const GcStats& stats() const;
+
+    /**
+     * The number of possible roots buffered for the next collection.
+     */
+    unsigned int roots_pending() const;
+
 private:
 
-    void mark_roots() const;
+    void collect_cycles_bounded(unsigned int max_node_visits, std::chrono::microseconds max_time) const;
+
+    void mark_roots(unsigned int max_node_visits, std::chrono::microseconds max_time) const;
 
     void mark_gray(GcNode& s) const;
 
@@ -50,28 +116,34 @@ private:
 
     void scan(GcNode& s) const;
 
-    void scan_black(GcNode& s) const;
+    void scan_black(GcNodeData* s) const;
 
-    void reset_ref_count_adj(GcNode& s) const;
+    void reset_ref_count_adj() const;
 
     void collect_roots() const;
 
     void collect_white(GcNode& s, std::vector<GcNode>& white) const;
 } GcCtx;
 
-struct GcNodeData;
-typedef struct GcNodeData GcNodeData;
-
+/**
+ * A handle to a node of the GC graph. Everything about the node lives in the
+ * shared GcNodeData, so copying a handle is just a reference count bump.
+ */
 struct GcNode {
-    unsigned int id;
-    std::string name;
-    GcCtx gc_ctx;
     std::shared_ptr<GcNodeData> data;
 
+    /**
+     * The name is kept as given, not copied, so it must be a string literal
+     * (or otherwise outlive the node).
+     */
     template <typename DECONSTRUCTOR, typename TRACE>
-    GcNode(GcCtx gc_ctx, std::string name, DECONSTRUCTOR deconstructor, TRACE trace);
+    GcNode(GcCtx gc_ctx, const char* name, DECONSTRUCTOR deconstructor, TRACE trace);
 
-    GcNode(const GcNode& other): id(other.id), name(other.name), gc_ctx(other.gc_ctx), data(other.data) {}
+    GcNode(const GcNode& other): data(other.data) {}
+
+    unsigned int id() const;
+
+    const char* name() const;
 
     unsigned int ref_count() const;
 
@@ -85,14 +157,16 @@ struct GcNode {
 
     void free() const;
 
-    template <typename TRACER>
-    void trace(TRACER tracer);
+    void trace(std::function<Tracer>& tracer) const;
 
 private:
     GcNode();
 };
 
 struct GcNodeData {
+    unsigned int id;
+    const char* name;
+    std::shared_ptr<GcCtxData> gc_ctx_data;
     bool freed;
     unsigned int ref_count;
     unsigned int ref_count_adj;
@@ -105,18 +179,37 @@ struct GcNodeData {
 
 struct GcCtxData {
     unsigned int next_id;
+    // Control blocks for the nodes of this context come from here.
+    std::shared_ptr<Slab> slab;
     std::vector<GcNode> roots;
+    // Scratch space for mark_roots(), kept to reuse its capacity.
+    std::vector<GcNode> old_roots;
     std::vector<GcNode> to_be_freed;
+    // Roots still buffered after mark_roots() ran out of budget.
+    std::vector<GcNode> deferred_roots;
+    // Nodes visited by mark_gray() in the current collection.
+    unsigned int node_visits;
+    // Work stacks for the collection phases, kept to reuse their capacity.
+    std::vector<GcNodeData*> stack;
+    std::vector<GcNodeData*> black_stack;
+    std::vector<GcNodeData*> visited;
+    std::vector<GcNode> white_stack;
+    // Nodes freed while another node's deconstructor is running.
+    std::vector<GcNode> to_deconstruct;
+    bool deconstructing;
+    GcConfig config;
+    GcStats stats;
 
     GcCtxData();
 };
 
 
 template <typename DECONSTRUCTOR, typename TRACE>
-GcNode::GcNode(GcCtx gc_ctx, std::string name, DECONSTRUCTOR deconstructor, TRACE trace)
-: gc_ctx(gc_ctx), name(name) {
-    this->id = gc_ctx.make_id();
-    GcNodeData* data = new GcNodeData();
+GcNode::GcNode(GcCtx gc_ctx, const char* name, DECONSTRUCTOR deconstructor, TRACE trace) {
+    std::shared_ptr<GcNodeData> data = slab_make_shared<GcNodeData>(gc_ctx.data->slab);
+    data->id = gc_ctx.make_id();
+    data->name = name;
+    data->gc_ctx_data = gc_ctx.data;
     data->freed = false;
     data->ref_count = 1;
     data->ref_count_adj = 0;
@@ -125,12 +218,7 @@ GcNode::GcNode(GcCtx gc_ctx, std::string name, DECONSTRUCTOR deconstructor, TRAC
     data->buffered = false;
     data->deconstructor = deconstructor;
     data->trace = trace;
-    this->data = std::shared_ptr<GcNodeData>(data);
-}
-
-template <typename TRACER>
-void GcNode::trace(TRACER tracer) {
-    (this->data->trace)(std::function<Tracer>(tracer));
+    this->data = data;
 }
 
 }
@@ -0,0 +1,42 @@
+#include "sodium/impl/inbox.h"
+
+namespace sodium {
+
+namespace impl {
+
+Inbox::Inbox(): head(nullptr) {
+}
+
+Inbox::~Inbox() {
+    InboxItem* item = this->head.exchange(nullptr);
+    while (item != nullptr) {
+        InboxItem* next = item->next;
+        delete item;
+        item = next;
+    }
+}
+
+void Inbox::push(std::function<void()> k) {
+    InboxItem* item = new InboxItem();
+    item->k = std::move(k);
+    item->next = this->head.load(std::memory_order_relaxed);
+    while (!this->head.compare_exchange_weak(item->next, item, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+}
+
+InboxItem* Inbox::take_all() {
+    InboxItem* item = this->head.exchange(nullptr, std::memory_order_acquire);
+    // Producers push onto the front, so reverse to get sending order back.
+    InboxItem* result = nullptr;
+    while (item != nullptr) {
+        InboxItem* next = item->next;
+        item->next = result;
+        result = item;
+        item = next;
+    }
+    return result;
+}
+
+}
+
+}
@@ -0,0 +1,47 @@
+#ifndef __SODIUM_CXX_IMPL_INBOX_H__
+#define __SODIUM_CXX_IMPL_INBOX_H__
+
+#include <atomic>
+#include <functional>
+
+namespace sodium {
+
+namespace impl {
+
+typedef struct InboxItem {
+    std::function<void()> k;
+    InboxItem* next;
+} InboxItem;
+
+/**
+ * A lock-free multi-producer, single-consumer queue of sends. Any thread may
+ * push, and producers never wait on each other or on the consumer; only the
+ * thread that owns the context may take.
+ */
+class Inbox {
+private:
+    std::atomic<InboxItem*> head;
+
+    Inbox(const Inbox&);
+
+    Inbox& operator=(const Inbox&);
+
+public:
+    Inbox();
+
+    ~Inbox();
+
+    void push(std::function<void()> k);
+
+    /**
+     * Takes everything pushed so far as a list, oldest first. The caller
+     * owns the items.
+     */
+    InboxItem* take_all();
+};
+
+}
+
+}
+
+#endif // __SODIUM_CXX_IMPL_INBOX_H__
@@ -8,9 +8,10 @@ namespace impl {
 
 
 struct ListenerData {
-    SodiumCtx sodium_ctx;
+    SodiumCtx sodium_ctx = SodiumCtx(nullptr);
     bool is_weak;
     boost::optional<Node> node_op;
+    boost::optional<unsigned int> keep_alive_index_op;
 };
 
 Listener Listener::mkListener(SodiumCtx& sodium_ctx, bool is_weak, Node node) {
@@ -35,7 +36,7 @@ Listener Listener::mkListener(SodiumCtx& sodium_ctx, bool is_weak, Node node) {
         listener_data,
         GcNode(
             node.sodium_ctx.gc_ctx(),
-            std::string("Listener::mkListener"),
+            "Listener::mkListener",
             gc_node_deconstructor,
             gc_node_trace
         )
@@ -46,6 +47,10 @@ Listener Listener::mkListener(SodiumCtx& sodium_ctx, bool is_weak, Node node) {
     return listener;
 }
 
+boost::optional<unsigned int>& Listener::keep_alive_index_op() const {
+    return this->data->keep_alive_index_op;
+}
+
 void Listener::unlisten() const {
     this->data->node_op = boost::none;
     if (!this->data->is_weak) {
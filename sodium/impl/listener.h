@@ -26,6 +26,11 @@ typedef struct Listener {
     static Listener mkListener(SodiumCtx& sodium_ctx, bool is_weak, Node node);
 
     void unlisten() const;
+
+    /**
+     * Where the listener is in its context's keep_alive, while it is there.
+     */
+    boost::optional<unsigned int>& keep_alive_index_op() const;
 } Listener;
 
 }
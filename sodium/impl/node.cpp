@@ -4,36 +4,97 @@ namespace sodium {
 
 namespace impl {
 
-std::unordered_set<NodeData*> living_nodes;
+void ensure_bigger_than(const std::shared_ptr<NodeData>& node_data, unsigned int limit) {
+    if (node_data->rank > limit) {
+        return;
+    }
+    // Raise the rank of the node and everything downstream of it. The visited
+    // set stops the walk going around a loop forever.
+    std::unordered_set<NodeData*> visited;
+    std::vector<std::pair<std::shared_ptr<NodeData>, unsigned int>> stack;
+    stack.push_back(std::make_pair(node_data, limit));
+    while (stack.size() != 0) {
+        std::shared_ptr<NodeData> node_data2 = stack.back().first;
+        unsigned int limit2 = stack.back().second;
+        stack.pop_back();
+        if (node_data2->rank > limit2 || visited.find(node_data2.get()) != visited.end()) {
+            continue;
+        }
+        visited.insert(node_data2.get());
+        node_data2->rank = limit2 + 1;
+        std::vector<Dependent>& dependents = node_data2->dependents;
+        for (auto dependent = dependents.begin(); dependent != dependents.end(); ++dependent) {
+            std::shared_ptr<NodeData> dependent2 = dependent->node_data.lock();
+            if (dependent2) {
+                stack.push_back(std::make_pair(dependent2, node_data2->rank));
+            }
+        }
+    }
+    node_data->sodium_ctx.data->to_regen = true;
+}
 
 GcNode IsNode::gc_node() {
     return this->node().gc_node;
 }
 
+void add_dependency_edge(const std::shared_ptr<NodeData>& node_data, NodeRef dependency, bool listed) {
+    unsigned int dependent_index = NOT_LISTED;
+    if (listed) {
+        std::vector<Dependent>& dependents = dependency.data->dependents;
+        dependent_index = dependents.size();
+        dependents.push_back(Dependent(node_data, node_data->dependencies.size()));
+    }
+    node_data->dependencies.push_back(std::move(dependency));
+    node_data->dependent_indices.push_back(dependent_index);
+}
+
+void remove_dependency_edge(NodeData& node_data, unsigned int index) {
+    std::vector<NodeRef>& dependencies = node_data.dependencies;
+    std::vector<unsigned int>& dependent_indices = node_data.dependent_indices;
+    // Dropping the reference can free nodes, so only do it once both sides
+    // of the edge are consistent again.
+    NodeRef dependency = std::move(dependencies[index]);
+    unsigned int dependent_index = dependent_indices[index];
+    if (dependent_index != NOT_LISTED) {
+        std::vector<Dependent>& dependents = dependency.data->dependents;
+        if (dependent_index + 1 != dependents.size()) {
+            dependents[dependent_index] = std::move(dependents.back());
+            Dependent& moved = dependents[dependent_index];
+            std::shared_ptr<NodeData> moved_data = moved.node_data.lock();
+            if (moved_data) {
+                moved_data->dependent_indices[moved.dependency_index] = dependent_index;
+            }
+        }
+        dependents.pop_back();
+    }
+    unsigned int last = dependencies.size() - 1;
+    if (index != last) {
+        dependencies[index] = std::move(dependencies[last]);
+        dependent_indices[index] = dependent_indices[last];
+        if (dependent_indices[index] != NOT_LISTED) {
+            dependencies[index].data->dependents[dependent_indices[index]].dependency_index = index;
+        }
+    }
+    dependencies.pop_back();
+    dependent_indices.pop_back();
+}
+
 void IsNode::add_dependency(const IsNode& dependency) const {
-    this->node().data->dependencies.push_back(dependency.box_clone());
-    dependency.node().data->dependents.push_back(this->downgrade());
+    add_dependency_edge(this->node().data, NodeRef(dependency.node()), true);
+    ensure_bigger_than(this->node().data, dependency.node().data->rank);
 }
 
 void IsNode::remove_dependency(const IsNode& dependency) const {
-    std::vector<std::unique_ptr<IsNode>>& dependencies = this->node().data->dependencies;
-    for (auto dependency2 = dependencies.begin(); dependency2 != dependencies.end(); ++dependency2) {
-        if ((*dependency2)->node().data == dependency.node().data) {
-            dependencies.erase(dependency2);
+    NodeData& node_data = *this->node().data;
+    const std::shared_ptr<NodeData>& dependency_data = dependency.node().data;
+    // A node has few dependencies, so finding the edge is cheap. The
+    // dependency's side, which can be large, is found by index.
+    for (unsigned int index = 0; index < node_data.dependencies.size(); ++index) {
+        if (node_data.dependencies[index].data == dependency_data) {
+            remove_dependency_edge(node_data, index);
             break;
         }
     }
-    std::vector<std::unique_ptr<IsWeakNode>>& dependents = dependency.node().data->dependents;
-    for (auto dependent = dependents.begin(); dependent != dependents.end(); ++dependent) {
-        boost::optional<std::unique_ptr<IsNode>> dependent2_op = (*dependent)->node().upgrade();
-        if (dependent2_op) {
-            std::unique_ptr<IsNode>& dependent2 = *dependent2_op;
-            if (dependent2->node().data == this->node().data) {
-                dependents.erase(dependent);
-                break;
-            }
-        }
-    }
 }
 
 void IsNode::add_keep_alive(const GcNode& gc_node) const {
@@ -41,29 +102,29 @@ void IsNode::add_keep_alive(const GcNode& gc_node) const {
 }
 
 void IsNode::debug(std::ostream& os) const {
-    std::unordered_set<const IsNode*> visited;
-    std::vector<const IsNode*> stack;
-    stack.push_back(this);
+    std::unordered_set<const NodeData*> visited;
+    std::vector<std::pair<const NodeData*, unsigned int>> stack;
+    stack.push_back(std::make_pair(this->node().data.get(), this->node().gc_node.id()));
     while (stack.size() != 0) {
-        const IsNode* at = stack[stack.size()-1];
+        const NodeData* at = stack.back().first;
+        unsigned int id = stack.back().second;
         stack.pop_back();
         if (visited.find(at) != visited.end()) {
             continue;
         }
         visited.insert(at);
-        os << "(Node N" << at->node().gc_node.id << " (dependencies [";
-        auto& dependencies = at->node().data->dependencies;
+        os << "(Node N" << id << " (dependencies [";
+        const std::vector<NodeRef>& dependencies = at->dependencies;
         {
             bool first = true;
             for (auto dependency = dependencies.begin(); dependency != dependencies.end(); ++dependency) {
-                const IsNode* dependency2 = &**dependency;
                 if (!first) {
                     os << ", ";
                 } else {
                     first = false;
                 }
-                os << dependency2->node().gc_node.id;
-                stack.push_back(dependency2);
+                os << dependency->gc_node.id();
+                stack.push_back(std::make_pair(dependency->data.get(), dependency->gc_node.id()));
             }
         }
         os << "])" << std::endl;
@@ -89,20 +150,32 @@ WeakNode Node::downgrade2() const {
     return WeakNode(this->data, this->gc_node, this->sodium_ctx);
 }
 
-std::vector<std::unique_ptr<IsNode>> box_clone_vec_is_node(std::vector<std::unique_ptr<IsNode>>& xs) {
-    std::vector<std::unique_ptr<IsNode>> result;
-    for (auto x = xs.begin(); x != xs.end(); ++x) {
-        result.push_back((*x)->box_clone());
-    }
-    return result;
+NodeRef::NodeRef(const Node& node): data(node.data), gc_node(node.gc_node) {
+    this->gc_node.inc_ref();
+    this->data->sodium_ctx.inc_node_ref_count();
+}
+
+NodeRef::NodeRef(const NodeRef& other): data(other.data), gc_node(other.gc_node) {
+    this->gc_node.inc_ref();
+    this->data->sodium_ctx.inc_node_ref_count();
 }
 
-std::vector<std::unique_ptr<IsWeakNode>> box_clone_vec_is_weak_node(std::vector<std::unique_ptr<IsWeakNode>>& xs) {
-    std::vector<std::unique_ptr<IsWeakNode>> result;
-    for (auto x = xs.begin(); x != xs.end(); ++x) {
-        result.push_back((*x)->box_clone());
+NodeRef::NodeRef(NodeRef&& other) noexcept: data(std::move(other.data)), gc_node(other.gc_node) {
+}
+
+NodeRef::~NodeRef() {
+    // Moved from.
+    if (!this->data) {
+        return;
     }
-    return result;
+    this->gc_node.dec_ref();
+    this->data->sodium_ctx.dec_node_ref_count();
+}
+
+NodeRef& NodeRef::operator=(NodeRef other) {
+    std::swap(this->data, other.data);
+    std::swap(this->gc_node.data, other.gc_node.data);
+    return *this;
 }
 
 }
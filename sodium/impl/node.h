@@ -1,6 +1,7 @@
 #ifndef __SODIUM_CXX_IMPL_NODE_H__
 #define __SODIUM_CXX_IMPL_NODE_H__
 
+#include <climits>
 #include <memory>
 #include <string>
 #include <vector>
@@ -26,6 +27,23 @@ typedef struct WeakNode WeakNode;
 
 class IsWeakNode;
 
+/**
+ * A node that depends on another, as listed by the other node, and where the
+ * edge is in the dependent's dependencies. The two sides of an edge know each
+ * other's index, so either can remove it without a search.
+ */
+typedef struct Dependent {
+    std::weak_ptr<NodeData> node_data;
+    unsigned int dependency_index;
+
+    Dependent(std::weak_ptr<NodeData> node_data, unsigned int dependency_index)
+    : node_data(std::move(node_data)), dependency_index(dependency_index) {}
+} Dependent;
+
+// In NodeData::dependent_indices, for a dependency that does not list the
+// node among its dependents.
+const unsigned int NOT_LISTED = UINT_MAX;
+
 class IsNode {
 public:
     virtual ~IsNode() {}
@@ -58,6 +76,40 @@ public:
     virtual boost::optional<std::unique_ptr<IsNode>> upgrade() const = 0;
 };
 
+/**
+ * A node's strong reference to one of its dependencies. It keeps the
+ * dependency alive as a Node handle does, but holds only the node's data and
+ * GC node, so dependency lists are flat and walking them makes no virtual
+ * calls.
+ */
+typedef struct NodeRef {
+    std::shared_ptr<NodeData> data;
+    GcNode gc_node;
+
+    NodeRef(const Node& node);
+
+    NodeRef(const NodeRef& other);
+
+    NodeRef(NodeRef&& other) noexcept;
+
+    ~NodeRef();
+
+    NodeRef& operator=(NodeRef other);
+} NodeRef;
+
+/**
+ * Adds an edge from a node to a dependency. If listed, the dependency also
+ * lists the node among its dependents, so the node is updated when the
+ * dependency fires.
+ */
+void add_dependency_edge(const std::shared_ptr<NodeData>& node_data, NodeRef dependency, bool listed);
+
+/**
+ * Removes the edge from a node to its index'th dependency in O(1). The gaps
+ * left on both sides are filled with the last entry.
+ */
+void remove_dependency_edge(NodeData& node_data, unsigned int index);
+
 class Node: public IsNode {
 public:
     std::shared_ptr<NodeData> data;
@@ -65,41 +117,25 @@ public:
     SodiumCtx sodium_ctx;
 
     template <typename UPDATE>
-    static Node mk_node(SodiumCtx sodium_ctx, std::string name, UPDATE update, std::vector<std::unique_ptr<IsNode>> dependencies) {
-        std::shared_ptr<std::vector<std::shared_ptr<NodeData>>> forward_ref = std::shared_ptr<std::vector<std::shared_ptr<NodeData>>>(new std::vector<std::shared_ptr<NodeData>>());
+    static Node mk_node(SodiumCtx sodium_ctx, const char* name, UPDATE update, std::vector<std::unique_ptr<IsNode>> dependencies) {
+        std::shared_ptr<std::vector<std::shared_ptr<NodeData>>> forward_ref = slab_make_shared<std::vector<std::shared_ptr<NodeData>>>(sodium_ctx.slab());
         auto deconstructor = [forward_ref]() {
             std::shared_ptr<NodeData> node_data = (*forward_ref)[0];
-            std::vector<std::unique_ptr<IsNode>> dependencies;
-            dependencies.swap(node_data->dependencies);
-            std::vector<std::unique_ptr<IsWeakNode>> dependents;
-            dependents.swap(node_data->dependents);
             node_data->update_dependencies.clear();
             std::vector<GcNode> keep_alive;
             keep_alive.swap(node_data->keep_alive);
             node_data->update = std::function<void()>([] {});
-            for (auto dependency = dependencies.begin(); dependency != dependencies.end(); ++dependency) {
-                std::vector<std::unique_ptr<IsWeakNode>>& dependents = (*dependency)->node().data->dependents;
-                for (auto dependent = dependents.begin(); dependent != dependents.end(); ++dependent) {
-                    std::shared_ptr<NodeData> dependent2 = (*dependent)->node().data.lock();
-                    if (dependent2) {
-                        if (dependent2 == node_data) {
-                            dependents.erase(dependent);
-                            break;
-                        }
-                    }
-                }
+            // Always take the last edge, so nothing has to be moved.
+            while (node_data->dependencies.size() != 0) {
+                remove_dependency_edge(*node_data, node_data->dependencies.size() - 1);
             }
-            for (auto dependent = dependents.begin(); dependent != dependents.end(); ++dependent) {
-                boost::optional<std::unique_ptr<IsNode>> dependent2_op = (*dependent)->upgrade();
-                if (dependent2_op) {
-                    std::unique_ptr<IsNode> dependent2 = std::move(*dependent2_op);
-                    std::vector<std::unique_ptr<IsNode>>& dependencies = dependent2->node().data->dependencies;
-                    for (auto dependency = dependencies.begin(); dependency != dependencies.end(); ++dependency) {
-                        if ((*dependency)->node().data == node_data) {
-                            dependencies.erase(dependency);
-                            break;
-                        }
-                    }
+            std::vector<Dependent>& dependents = node_data->dependents;
+            while (dependents.size() != 0) {
+                std::shared_ptr<NodeData> dependent = dependents.back().node_data.lock();
+                if (dependent) {
+                    remove_dependency_edge(*dependent, dependents.back().dependency_index);
+                } else {
+                    dependents.pop_back();
                 }
             }
             for (auto node = keep_alive.begin(); node != keep_alive.end(); ++node) {
@@ -107,12 +143,12 @@ public:
             }
             forward_ref->clear();
         };
-        auto trace = [forward_ref](std::function<Tracer> tracer) {
+        auto trace = [forward_ref](std::function<Tracer>& tracer) {
             std::shared_ptr<NodeData> node_data = (*forward_ref)[0];
             {
-                std::vector<std::unique_ptr<IsNode>>& dependencies = node_data->dependencies;
+                std::vector<NodeRef>& dependencies = node_data->dependencies;
                 for (auto dependency = dependencies.begin(); dependency != dependencies.end(); ++dependency) {
-                    tracer((*dependency)->gc_node());
+                    tracer(dependency->gc_node);
                 }
             }
             {
@@ -128,15 +164,17 @@ public:
                 }
             }
         };
-        std::shared_ptr<NodeData> node_data;
-        {
-            NodeData* _node_data = new NodeData(sodium_ctx);
-            _node_data->visited = false;
-            _node_data->changed = false;
-            _node_data->update = update;
-            _node_data->dependencies = box_clone_vec_is_node(dependencies);
-            node_data = std::unique_ptr<NodeData>(_node_data);
+        std::shared_ptr<NodeData> node_data = slab_make_shared<NodeData>(sodium_ctx.slab(), sodium_ctx);
+        node_data->visited = false;
+        node_data->changed = false;
+        node_data->rank = 0;
+        for (auto dependency = dependencies.begin(); dependency != dependencies.end(); ++dependency) {
+            unsigned int rank = (*dependency)->node().data->rank + 1;
+            if (rank > node_data->rank) {
+                node_data->rank = rank;
+            }
         }
+        node_data->update = update;
         Node node(
             node_data,
             GcNode(sodium_ctx.gc_ctx(), name, deconstructor, trace),
@@ -144,14 +182,13 @@ public:
         );
         forward_ref->push_back(node_data);
         for (auto dependency = dependencies.begin(); dependency != dependencies.end(); ++dependency) {
-            Node dependency2 = (*dependency)->node();
-            dependency2.data->dependents.push_back(node.downgrade());
+            add_dependency_edge(node_data, NodeRef((*dependency)->node()), true);
         }
         return node;
     }
 
     template <typename UPDATE>
-    Node(SodiumCtx sodium_ctx, std::string name, UPDATE update, std::vector<std::unique_ptr<IsNode>> dependencies)
+    Node(SodiumCtx sodium_ctx, const char* name, UPDATE update, std::vector<std::unique_ptr<IsNode>> dependencies)
     : Node(Node::mk_node(sodium_ctx, name, update, std::move(dependencies)))
     {
     }
@@ -199,25 +236,33 @@ public:
     WeakNode downgrade2() const;
 };
 
-extern std::unordered_set<NodeData*> living_nodes;
-
-typedef struct NodeData {
+typedef struct NodeData: public std::enable_shared_from_this<NodeData> {
     bool visited;
     bool changed;
+    // Always greater than the rank of every dependency, so that updating
+    // nodes in ascending rank order never observes a stale dependency.
+    unsigned int rank;
     std::function<void()> update;
     std::vector<Dep> update_dependencies;
-    std::vector<std::unique_ptr<IsNode>> dependencies;
-    std::vector<std::unique_ptr<IsWeakNode>> dependents;
+    std::vector<NodeRef> dependencies;
+    // For each of dependencies, where this node is in that dependency's
+    // dependents, or NOT_LISTED.
+    std::vector<unsigned int> dependent_indices;
+    std::vector<Dependent> dependents;
     std::vector<GcNode> keep_alive;
     SodiumCtx sodium_ctx;
 
     NodeData(SodiumCtx sodium_ctx): sodium_ctx(sodium_ctx) {
         this->sodium_ctx.inc_node_count();
-        living_nodes.insert(this);
+#ifdef SODIUM_TRACK_LIVING_NODES
+        this->sodium_ctx.data->living_nodes.insert(this);
+#endif
     }
 
     ~NodeData() {
-        living_nodes.erase(living_nodes.find(this));
+#ifdef SODIUM_TRACK_LIVING_NODES
+        this->sodium_ctx.data->living_nodes.erase(this);
+#endif
         this->sodium_ctx.dec_node_count();
     }
 
@@ -260,9 +305,7 @@ typedef struct WeakNode: public IsWeakNode {
     }
 } WeakNode;
 
-std::vector<std::unique_ptr<IsNode>> box_clone_vec_is_node(std::vector<std::unique_ptr<IsNode>>& xs);
-
-std::vector<std::unique_ptr<IsWeakNode>> box_clone_vec_is_weak_node(std::vector<std::unique_ptr<IsWeakNode>>& xs);
+void ensure_bigger_than(const std::shared_ptr<NodeData>& node_data, unsigned int limit);
 
 }
 
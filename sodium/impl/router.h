@@ -0,0 +1,141 @@
+#ifndef __SODIUM_IMPL_ROUTER_H__
+#define __SODIUM_IMPL_ROUTER_H__
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/optional.hpp>
+#include "sodium/impl/lambda.h"
+#include "sodium/impl/node.h"
+#include "sodium/impl/stream.h"
+#include "sodium/impl/stream_impl.h"
+
+namespace sodium {
+
+namespace impl {
+
+template <typename A>
+class RouterTarget {
+public:
+    std::weak_ptr<StreamData<A>> stream_data;
+    std::weak_ptr<NodeData> node_data;
+
+    RouterTarget(std::weak_ptr<StreamData<A>> stream_data, std::weak_ptr<NodeData> node_data)
+    : stream_data(stream_data), node_data(node_data) {}
+};
+
+template <typename A, typename Selector>
+class RoutingTable {
+public:
+    // The router's node, set once it is made. The node's update owns the
+    // table, so this cannot dangle while the update runs.
+    NodeData* node_data;
+    std::unordered_map<Selector, std::vector<RouterTarget<A>>> targets;
+};
+
+/**
+ * Routes each event of a stream to the outputs made for the key it selects.
+ *
+ * The outputs are not registered as dependents of the router's node, so an
+ * event does not visit every output. Instead the router's update looks the
+ * key up, fires the matching outputs directly and puts just those nodes into
+ * the transaction's rank order.
+ */
+template <typename A, typename Selector>
+class Router {
+public:
+    std::shared_ptr<RoutingTable<A, Selector>> table;
+    Node node;
+
+    Router(std::shared_ptr<RoutingTable<A, Selector>> table, Node node): table(table), node(node) {}
+
+    template <typename FN>
+    static Router<A, Selector> mkRouter(const Stream<A>& in, FN f) {
+        std::shared_ptr<RoutingTable<A, Selector>> table = std::unique_ptr<RoutingTable<A, Selector>>(new RoutingTable<A, Selector>());
+        std::vector<Dep> f_deps = GetDeps<FN>::call(f);
+        std::vector<std::unique_ptr<IsNode>> dependencies;
+        dependencies.push_back(in.box_clone());
+        Node node = Node::mk_node(
+            in.sodium_ctx(),
+            "Router",
+            [in, f, table]() {
+                boost::optional<A>& firing_op = in.data->firing_op;
+                if (!firing_op) {
+                    return;
+                }
+                auto targets = table->targets.find(f(*firing_op));
+                if (targets == table->targets.end()) {
+                    return;
+                }
+                for (auto target = targets->second.begin(); target != targets->second.end(); ++target) {
+                    std::shared_ptr<StreamData<A>> stream_data = target->stream_data.lock();
+                    std::shared_ptr<NodeData> node_data = target->node_data.lock();
+                    if (stream_data && node_data) {
+                        stream_data->fire(*firing_op);
+                        // The router's rank may have been raised since the
+                        // output was made, and that does not reach the output.
+                        ensure_bigger_than(node_data, table->node_data->rank);
+                        in.sodium_ctx().prioritize(node_data);
+                    }
+                }
+            },
+            std::move(dependencies)
+        );
+        node.add_update_dependency(in.to_dep());
+        node.add_update_dependencies(f_deps);
+        table->node_data = node.data.get();
+        return Router<A, Selector>(table, node);
+    }
+
+    Stream<A> filter_equals(const Selector& sel) const {
+        Node router_node = this->node;
+        Stream<A> s = Stream<A>::mkStream(
+            this->node.sodium_ctx,
+            [router_node](StreamWeakForwardRef<A> s) {
+                Node node = Node::mk_node(
+                    router_node.sodium_ctx,
+                    "Router::filter_equals",
+                    []() {},
+                    std::vector<std::unique_ptr<IsNode>>()
+                );
+                // Depend on the router to keep it alive and to rank after it,
+                // but stay out of its dependents (see Router).
+                add_dependency_edge(node.data, NodeRef(router_node), false);
+                node.data->rank = router_node.data->rank + 1;
+                return node;
+            }
+        );
+        this->table->targets[sel].push_back(RouterTarget<A>(s.data, s._node.data));
+        std::weak_ptr<RoutingTable<A, Selector>> weak_table = this->table;
+        s.data->cleanups.push_back([weak_table, sel]() {
+            std::shared_ptr<RoutingTable<A, Selector>> table = weak_table.lock();
+            if (!table) {
+                return;
+            }
+            auto targets = table->targets.find(sel);
+            if (targets == table->targets.end()) {
+                return;
+            }
+            // The stream being destroyed has already expired.
+            std::vector<RouterTarget<A>>& targets2 = targets->second;
+            for (auto target = targets2.begin(); target != targets2.end();) {
+                if (target->stream_data.expired()) {
+                    target = targets2.erase(target);
+                } else {
+                    ++target;
+                }
+            }
+            if (targets2.size() == 0) {
+                table->targets.erase(targets);
+            }
+        });
+        return s;
+    }
+};
+
+}
+
+}
+
+#endif // __SODIUM_IMPL_ROUTER_H__
@@ -0,0 +1,56 @@
+#include "sodium/impl/slab.h"
+
+#include <new>
+
+namespace sodium {
+
+namespace impl {
+
+Slab::Slab()
+: free_lists(SLAB_MAX_BLOCK / SLAB_GRANULE, nullptr), chunk_next(nullptr), chunk_end(nullptr) {
+}
+
+Slab::~Slab() {
+    for (auto chunk = this->chunks.begin(); chunk != this->chunks.end(); ++chunk) {
+        ::operator delete(*chunk);
+    }
+}
+
+void* Slab::allocate(std::size_t size) {
+    if (size == 0 || size > SLAB_MAX_BLOCK) {
+        return ::operator new(size);
+    }
+    std::size_t size_class = (size - 1) / SLAB_GRANULE;
+    FreeBlock* block = this->free_lists[size_class];
+    if (block != nullptr) {
+        this->free_lists[size_class] = block->next;
+        return block;
+    }
+    std::size_t block_size = (size_class + 1) * SLAB_GRANULE;
+    if ((std::size_t)(this->chunk_end - this->chunk_next) < block_size) {
+        // The tail of the old chunk is abandoned. It is smaller than this
+        // block, so less than SLAB_MAX_BLOCK bytes go to waste.
+        char* chunk = static_cast<char*>(::operator new(SLAB_CHUNK_SIZE));
+        this->chunks.push_back(chunk);
+        this->chunk_next = chunk;
+        this->chunk_end = chunk + SLAB_CHUNK_SIZE;
+    }
+    void* result = this->chunk_next;
+    this->chunk_next = this->chunk_next + block_size;
+    return result;
+}
+
+void Slab::deallocate(void* p, std::size_t size) {
+    if (size == 0 || size > SLAB_MAX_BLOCK) {
+        ::operator delete(p);
+        return;
+    }
+    std::size_t size_class = (size - 1) / SLAB_GRANULE;
+    FreeBlock* block = static_cast<FreeBlock*>(p);
+    block->next = this->free_lists[size_class];
+    this->free_lists[size_class] = block;
+}
+
+}
+
+}
@@ -0,0 +1,155 @@
+#ifndef __SODIUM_CXX_IMPL_SLAB_H__
+#define __SODIUM_CXX_IMPL_SLAB_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace sodium {
+
+namespace impl {
+
+/**
+ * A pool for the small, fixed-size control blocks that every node is made
+ * of. Sizes are rounded up to a multiple of SLAB_GRANULE, and each size class
+ * keeps a free list of returned blocks, carving new ones out of large chunks
+ * when it runs dry. Anything bigger than SLAB_MAX_BLOCK goes to the heap.
+ *
+ * Not thread safe. Like the context that owns it, only one thread may use it
+ * at a time.
+ */
+class Slab {
+public:
+    static const std::size_t SLAB_GRANULE = 16;
+    static const std::size_t SLAB_MAX_BLOCK = 512;
+    static const std::size_t SLAB_CHUNK_SIZE = 64 * 1024;
+
+    Slab();
+
+    ~Slab();
+
+    void* allocate(std::size_t size);
+
+    void deallocate(void* p, std::size_t size);
+
+private:
+    typedef struct FreeBlock {
+        FreeBlock* next;
+    } FreeBlock;
+
+    std::vector<FreeBlock*> free_lists;
+    std::vector<void*> chunks;
+    char* chunk_next;
+    char* chunk_end;
+
+    Slab(const Slab&);
+
+    Slab& operator=(const Slab&);
+};
+
+/**
+ * Standard allocator over a Slab. The allocator keeps the slab alive, so
+ * blocks may outlive the context that handed them out.
+ */
+template <typename T>
+class SlabAllocator {
+public:
+    typedef T value_type;
+
+    std::shared_ptr<Slab> slab;
+
+    SlabAllocator(std::shared_ptr<Slab> slab): slab(slab) {}
+
+    template <typename U>
+    SlabAllocator(const SlabAllocator<U>& other): slab(other.slab) {}
+
+    T* allocate(std::size_t n) {
+        static_assert(alignof(T) <= Slab::SLAB_GRANULE, "slab blocks are only SLAB_GRANULE aligned");
+        return static_cast<T*>(this->slab->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        this->slab->deallocate(p, n * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const SlabAllocator<T>& lhs, const SlabAllocator<U>& rhs) {
+    return lhs.slab == rhs.slab;
+}
+
+template <typename T, typename U>
+bool operator!=(const SlabAllocator<T>& lhs, const SlabAllocator<U>& rhs) {
+    return lhs.slab != rhs.slab;
+}
+
+/**
+ * Standard allocator over the heap that honours alignof(T) even where
+ * operator new does not over-align. The block's start is kept just before
+ * the aligned pointer.
+ */
+template <typename T>
+class AlignedAllocator {
+public:
+    typedef T value_type;
+
+    AlignedAllocator() {}
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        char* raw = static_cast<char*>(::operator new(n * sizeof(T) + alignof(T) + sizeof(void*)));
+        std::uintptr_t start = reinterpret_cast<std::uintptr_t>(raw + sizeof(void*));
+        std::uintptr_t aligned = (start + alignof(T) - 1) & ~(std::uintptr_t)(alignof(T) - 1);
+        reinterpret_cast<void**>(aligned)[-1] = raw;
+        return reinterpret_cast<T*>(aligned);
+    }
+
+    void deallocate(T* p, std::size_t) {
+        ::operator delete(reinterpret_cast<void**>(p)[-1]);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) {
+    return false;
+}
+
+template <typename T, typename... ARGS>
+std::shared_ptr<T> slab_make_shared_impl(std::true_type, const std::shared_ptr<Slab>& slab, ARGS&&... args) {
+    return std::allocate_shared<T>(SlabAllocator<T>(slab), std::forward<ARGS>(args)...);
+}
+
+template <typename T, typename... ARGS>
+std::shared_ptr<T> slab_make_shared_impl(std::false_type, const std::shared_ptr<Slab>&, ARGS&&... args) {
+    return std::allocate_shared<T>(AlignedAllocator<T>(), std::forward<ARGS>(args)...);
+}
+
+/**
+ * Like std::make_shared, but takes the object and its reference counts from
+ * the slab as a single block. Blocks are only SLAB_GRANULE aligned, so a type
+ * that needs more, such as a StreamData over an over-aligned payload, goes to
+ * the heap through an AlignedAllocator instead.
+ */
+template <typename T, typename... ARGS>
+std::shared_ptr<T> slab_make_shared(const std::shared_ptr<Slab>& slab, ARGS&&... args) {
+    return slab_make_shared_impl<T>(
+        std::integral_constant<bool, alignof(T) <= Slab::SLAB_GRANULE>(),
+        slab,
+        std::forward<ARGS>(args)...
+    );
+}
+}
+
+}
+
+#endif // __SODIUM_CXX_IMPL_SLAB_H__
@@ -1,65 +1,133 @@
 #include "sodium/impl/sodium_ctx.h"
 #include "sodium/impl/node.h"
 
+#include <algorithm>
+
 namespace sodium {
 
 namespace impl {
 
+// std heaps are max-heaps, so this orders the lowest (rank, seq) to the front.
+static bool prioritized_after(const PrioritizedNode& lhs, const PrioritizedNode& rhs) {
+    if (lhs.node_data->rank != rhs.node_data->rank) {
+        return lhs.node_data->rank > rhs.node_data->rank;
+    }
+    return lhs.seq > rhs.seq;
+}
+
+/**
+ * Adds the time each phase of a transaction takes to its total in the stats,
+ * when detailed stats are on.
+ */
+class PhaseTimer {
+private:
+    bool enabled;
+    std::chrono::steady_clock::time_point last;
+
+public:
+    PhaseTimer(bool enabled): enabled(enabled) {
+        if (enabled) {
+            this->last = std::chrono::steady_clock::now();
+        }
+    }
+
+    void lap(std::chrono::nanoseconds& total) {
+        if (!this->enabled) {
+            return;
+        }
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        total += now - this->last;
+        this->last = now;
+    }
+};
+
+static unsigned int histogram_bucket(unsigned long n) {
+    unsigned int bucket = 0;
+    while (n != 0 && bucket < 31) {
+        n >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+static thread_local SodiumCtx* scoped_sodium_ctx = nullptr;
+
+SodiumCtx& current_sodium_ctx() {
+    if (scoped_sodium_ctx != nullptr) {
+        return *scoped_sodium_ctx;
+    }
+    static thread_local SodiumCtx thread_sodium_ctx;
+    return thread_sodium_ctx;
+}
+
+SodiumCtxScope::SodiumCtxScope(SodiumCtx& sodium_ctx): previous(scoped_sodium_ctx) {
+    scoped_sodium_ctx = &sodium_ctx;
+}
+
+SodiumCtxScope::~SodiumCtxScope() {
+    scoped_sodium_ctx = this->previous;
+}
+
 SodiumCtx::SodiumCtx() {
     SodiumCtxData* data = new SodiumCtxData();
+    data->ref_count = 1;
+    data->node_count = 0;
+    data->node_ref_count = 0;
     data->transaction_depth = 0;
     data->callback_depth = 0;
     data->allow_collect_cycles_counter = 0;
-    this->data = std::unique_ptr<SodiumCtxData>(data);
-    this->node_count = std::make_shared<unsigned int>(0);
-    this->node_ref_count = std::make_shared<unsigned int>(0);
+    data->prioritized_seq = 0;
+    data->to_regen = false;
+    this->data = data;
+}
+
+SodiumCtx::~SodiumCtx() {
+    if (this->data != nullptr && this->data->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete this->data;
+    }
 }
 
-GcCtx SodiumCtx::gc_ctx() const {
-    return this->_gc_ctx;
+const std::shared_ptr<Slab>& SodiumCtx::slab() const {
+    return this->data->gc_ctx.data->slab;
 }
 
 Node SodiumCtx::null_node() const {
     return Node::mk_node(
         *this,
-        std::string("null_node"),
+        "null_node",
         []() {},
         std::vector<std::unique_ptr<IsNode>>()
     );
 }
 
-void SodiumCtx::inc_node_count() const {
-    unsigned int& node_count = *(this->node_count);
-    ++node_count;
-}
-
-void SodiumCtx::dec_node_count() const {
-    unsigned int& node_count = *(this->node_count);
-    --node_count;
-}
-
-void SodiumCtx::inc_node_ref_count() const {
-    unsigned int& node_ref_count = *(this->node_ref_count);
-    ++node_ref_count;
-}
-
-void SodiumCtx::dec_node_ref_count() const {
-    unsigned int& node_ref_count = *(this->node_ref_count);
-    --node_ref_count;
+void SodiumCtx::reset_num_nodes() const {
+    this->data->node_count = 0;
+    this->data->node_ref_count = 0;
+#ifdef SODIUM_TRACK_LIVING_NODES
+    this->data->living_nodes.clear();
+#endif
 }
 
 void SodiumCtx::add_dependents_to_changed_nodes(IsNode& node) {
-    std::vector<std::unique_ptr<IsWeakNode>>& dependents = node.node().data->dependents;
+    std::vector<Dependent>& dependents = node.node().data->dependents;
     for (auto dependent = dependents.begin(); dependent != dependents.end(); ++dependent) {
-        boost::optional<std::unique_ptr<IsNode>> dependent2_op = (*dependent)->upgrade();
-        if (dependent2_op) {
-            std::unique_ptr<IsNode> dependent2 = std::move(*dependent2_op);
+        std::shared_ptr<NodeData> dependent2 = dependent->node_data.lock();
+        if (dependent2) {
             this->data->changed_nodes.push_back(std::move(dependent2));
         }
     }
 }
 
+void SodiumCtx::reset_firing_at_end(std::shared_ptr<IsStreamData> stream_data, std::shared_ptr<NodeData> node_data) const {
+    Transaction t(*this);
+    this->data->firing_streams.push_back(FiringStream(std::move(stream_data), std::move(node_data)));
+}
+
 void SodiumCtx::end_of_transaction() const {
+    SodiumStats& stats = this->data->stats;
+    ++stats.transactions;
+    unsigned long node_updates_before = stats.node_updates;
+    PhaseTimer timer(stats.detailed);
     this->data->transaction_depth = this->data->transaction_depth + 1;
     this->data->allow_collect_cycles_counter = this->data->allow_collect_cycles_counter + 1;
     {
@@ -68,32 +136,86 @@ void SodiumCtx::end_of_transaction() const {
         for (auto k = pre_eot.begin(); k != pre_eot.end(); ++k) {
             (*k)();
         }
+        stats.pre_eot_callbacks += pre_eot.size();
     }
+    timer.lap(stats.pre_eot_time);
     while (this->data->changed_nodes.size() != 0) {
-        std::vector<std::unique_ptr<IsNode>> changed_nodes;
+        std::vector<std::shared_ptr<NodeData>> changed_nodes;
         changed_nodes.swap(this->data->changed_nodes);
-        for (auto node = changed_nodes.begin(); node != changed_nodes.end(); ++node) {
-            this->update_node((*node)->node());
+        for (auto node_data = changed_nodes.begin(); node_data != changed_nodes.end(); ++node_data) {
+            this->prioritize(*node_data);
         }
+        // Hand the buffer back so that the next transaction does not have to
+        // allocate it again.
+        changed_nodes.clear();
+        if (this->data->changed_nodes.size() == 0) {
+            changed_nodes.swap(this->data->changed_nodes);
+        }
+        std::vector<PrioritizedNode>& prioritized = this->data->prioritized;
+        while (prioritized.size() != 0) {
+            if (this->data->to_regen) {
+                std::make_heap(prioritized.begin(), prioritized.end(), prioritized_after);
+                this->data->to_regen = false;
+            }
+            std::pop_heap(prioritized.begin(), prioritized.end(), prioritized_after);
+            std::shared_ptr<NodeData> node_data = std::move(prioritized.back().node_data);
+            prioritized.pop_back();
+            this->visit_node(node_data);
+        }
+        this->data->prioritized_seq = 0;
+    }
+    {
+        std::vector<std::shared_ptr<NodeData>> visited_nodes;
+        visited_nodes.swap(this->data->visited_nodes);
+        for (auto node_data = visited_nodes.begin(); node_data != visited_nodes.end(); ++node_data) {
+            (*node_data)->visited = false;
+        }
+        visited_nodes.clear();
+        if (this->data->visited_nodes.size() == 0) {
+            visited_nodes.swap(this->data->visited_nodes);
+        }
+    }
+    timer.lap(stats.propagate_time);
+    if (stats.detailed) {
+        ++stats.node_updates_histogram[histogram_bucket(stats.node_updates - node_updates_before)];
     }
     this->data->transaction_depth = this->data->transaction_depth - 1;
     this->data->allow_collect_cycles_counter = this->data->allow_collect_cycles_counter - 1;
+    // Every node has seen this transaction's firings by now, but they are
+    // still in place, so pre_post callbacks can move them out.
     {
         std::vector<std::function<void()>> pre_post;
         pre_post.swap(this->data->pre_post);
         for (auto k = pre_post.begin(); k != pre_post.end(); ++k) {
             (*k)();
         }
+        stats.pre_post_callbacks += pre_post.size();
+    }
+    timer.lap(stats.pre_post_time);
+    {
+        std::vector<FiringStream> firing_streams;
+        firing_streams.swap(this->data->firing_streams);
+        for (auto firing_stream = firing_streams.begin(); firing_stream != firing_streams.end(); ++firing_stream) {
+            firing_stream->stream_data->reset_firing();
+            firing_stream->node_data->changed = false;
+        }
+        firing_streams.clear();
+        if (this->data->firing_streams.size() == 0) {
+            firing_streams.swap(this->data->firing_streams);
+        }
     }
+    timer.lap(stats.reset_time);
     {
         std::vector<std::function<void()>> post;
         post.swap(this->data->post);
         for (auto k = post.begin(); k != post.end(); ++k) {
             (*k)();
         }
+        stats.post_callbacks += post.size();
     }
+    timer.lap(stats.post_time);
     if (this->data->allow_collect_cycles_counter == 0) {
-        this->collect_cycles();
+        this->gc_ctx().collect_cycles_at_end_of_transaction();
     }
 }
 
@@ -101,32 +223,73 @@ void SodiumCtx::update_node(const Node& node) const {
     if (node.data->visited) {
         return;
     }
-    node.data->visited = true;
-    std::vector<std::unique_ptr<IsNode>> dependencies = box_clone_vec_is_node(node.data->dependencies);
-    {
-        Node node2 = node;
-        this->pre_post([node2]() {
-            node2.data->visited = false;
-        });
+    // Pulls the node out of rank order (used by switch_c), so any upstream
+    // node not yet visited in this transaction is brought up to date first.
+    std::vector<std::pair<std::shared_ptr<NodeData>, bool>> stack;
+    stack.push_back(std::make_pair(node.data, false));
+    while (stack.size() != 0) {
+        std::shared_ptr<NodeData> node_data = stack.back().first;
+        if (stack.back().second) {
+            stack.pop_back();
+            this->fire_node(node_data);
+            continue;
+        }
+        if (node_data->visited) {
+            stack.pop_back();
+            continue;
+        }
+        stack.back().second = true;
+        node_data->visited = true;
+        this->data->visited_nodes.push_back(node_data);
+        ++this->data->stats.node_visits;
+        std::vector<NodeRef>& dependencies = node_data->dependencies;
+        for (auto dependency = dependencies.begin(); dependency != dependencies.end(); ++dependency) {
+            const std::shared_ptr<NodeData>& dependency2 = dependency->data;
+            if (!dependency2->visited) {
+                stack.push_back(std::make_pair(dependency2, false));
+            }
+        }
     }
+}
+
+void SodiumCtx::prioritize(const std::shared_ptr<NodeData>& node_data) const {
+    std::vector<PrioritizedNode>& prioritized = this->data->prioritized;
+    prioritized.push_back(PrioritizedNode(this->data->prioritized_seq, node_data));
+    ++this->data->prioritized_seq;
+    std::push_heap(prioritized.begin(), prioritized.end(), prioritized_after);
+}
+
+void SodiumCtx::visit_node(const std::shared_ptr<NodeData>& node_data) const {
+    if (node_data->visited) {
+        return;
+    }
+    node_data->visited = true;
+    this->data->visited_nodes.push_back(node_data);
+    ++this->data->stats.node_visits;
+    this->fire_node(node_data);
+}
+
+void SodiumCtx::fire_node(const std::shared_ptr<NodeData>& node_data) const {
     bool any_changed = false;
-    for (auto dependency = dependencies.begin(); dependency != dependencies.end(); ++dependency) {
-        Node dependency2 = (*dependency)->node();
-        if (!dependency2.data->visited) {
-            this->update_node(dependency2);
+    {
+        std::vector<NodeRef>& dependencies = node_data->dependencies;
+        for (auto dependency = dependencies.begin(); dependency != dependencies.end(); ++dependency) {
+            if (dependency->data->changed) {
+                any_changed = true;
+                break;
+            }
         }
-        any_changed |= dependency2.data->changed;
     }
     if (any_changed) {
-        (node.data->update)();
+        ++this->data->stats.node_updates;
+        (node_data->update)();
     }
-    if (node.data->changed) {
-        std::vector<std::unique_ptr<IsWeakNode>> dependents = box_clone_vec_is_weak_node(node.data->dependents);
+    if (node_data->changed) {
+        std::vector<Dependent>& dependents = node_data->dependents;
         for (auto dependent = dependents.begin(); dependent != dependents.end(); ++dependent) {
-            boost::optional<std::unique_ptr<IsNode>> dependent2_op = (*dependent)->upgrade();
-            if (dependent2_op) {
-                std::unique_ptr<IsNode> dependent2 = std::move(*dependent2_op);
-                this->update_node(dependent2->node());
+            std::shared_ptr<NodeData> dependent2 = dependent->node_data.lock();
+            if (dependent2 && !dependent2->visited) {
+                this->prioritize(dependent2);
             }
         }
     }
@@ -136,18 +299,75 @@ void SodiumCtx::collect_cycles() const {
     this->gc_ctx().collect_cycles();
 }
 
+/**
+ * Owns the items taken from an inbox that have not been run yet, so that a
+ * send that throws does not leak the rest.
+ */
+typedef struct InboxItems {
+    InboxItem* head;
+
+    InboxItems(InboxItem* head): head(head) {}
+
+    ~InboxItems() {
+        while (this->head != nullptr) {
+            std::unique_ptr<InboxItem> item(this->head);
+            this->head = item->next;
+        }
+    }
+
+    std::unique_ptr<InboxItem> pop() {
+        std::unique_ptr<InboxItem> item(this->head);
+        this->head = item->next;
+        return item;
+    }
+} InboxItems;
+
+unsigned int SodiumCtx::drain_inbox(bool transaction_per_item) const {
+    InboxItems items(this->data->inbox.take_all());
+    if (items.head == nullptr) {
+        return 0;
+    }
+    unsigned int count = 0;
+    if (transaction_per_item) {
+        while (items.head != nullptr) {
+            std::unique_ptr<InboxItem> item = items.pop();
+            std::function<void()>& k = item->k;
+            this->transaction_void([&k]() { k(); });
+            ++count;
+        }
+    } else {
+        Transaction t(*this);
+        while (items.head != nullptr) {
+            std::unique_ptr<InboxItem> item = items.pop();
+            (item->k)();
+            ++count;
+        }
+        t.close();
+    }
+    return count;
+}
+
 void SodiumCtx::add_listener_to_keep_alive(const Listener& l) const {
-    this->data->keep_alive.push_back(l);
+    std::vector<Listener>& keep_alive = this->data->keep_alive;
+    l.keep_alive_index_op() = (unsigned int)keep_alive.size();
+    keep_alive.push_back(l);
 }
 
 void SodiumCtx::remove_listener_from_keep_alive(const Listener& l) const {
+    boost::optional<unsigned int>& index_op = l.keep_alive_index_op();
+    if (!index_op) {
+        return;
+    }
     std::vector<Listener>& keep_alive = this->data->keep_alive;
-    for (auto l2 = keep_alive.begin(); l2 != keep_alive.end(); ++l2) {
-        if (l2->data == l.data) {
-            keep_alive.erase(l2);
-            break;
-        }
+    unsigned int index = *index_op;
+    index_op = boost::none;
+    // Fill the gap with the last listener rather than shifting the rest
+    // down, so removing is O(1) however many listeners there are.
+    if (index + 1 != keep_alive.size()) {
+        keep_alive[index] = keep_alive.back();
+        keep_alive[index].keep_alive_index_op() = index;
     }
+    keep_alive.pop_back();
 }
 
 InCallback SodiumCtx::in_callback() const {
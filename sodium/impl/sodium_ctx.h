@@ -1,12 +1,19 @@
 #ifndef __SODIUM_CXX_IMPL_SODIUM_CTX_H__
 #define __SODIUM_CXX_IMPL_SODIUM_CTX_H__
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <memory>
 #include <type_traits>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "sodium/config.h"
 #include "sodium/impl/gc_node.h"
+#include "sodium/impl/inbox.h"
 #include "sodium/impl/listener.h"
 
 namespace sodium {
@@ -15,44 +22,184 @@ namespace impl {
 
 class Node;
 
+struct NodeData;
+typedef struct NodeData NodeData;
+
 struct SodiumCtxData;
 typedef struct SodiumCtxData SodiumCtxData;
 
 class IsNode;
 
+/**
+ * An entry in the propagation queue. Entries are ordered by the rank of
+ * their node first, then by the order they were queued in, so nodes of
+ * equal rank are updated in a deterministic order.
+ */
+typedef struct PrioritizedNode {
+    unsigned int seq;
+    std::shared_ptr<NodeData> node_data;
+
+    PrioritizedNode(unsigned int seq, std::shared_ptr<NodeData> node_data)
+    : seq(seq), node_data(std::move(node_data)) {}
+} PrioritizedNode;
+
+/**
+ * Implemented by StreamData so that a stream's firing can be cleared at the
+ * end of the transaction without the stream's type being known.
+ */
+class IsStreamData: public std::enable_shared_from_this<IsStreamData> {
+public:
+    virtual ~IsStreamData() {}
+
+    virtual void reset_firing() = 0;
+};
+
+/**
+ * A stream that fired in the current transaction, and the node that was
+ * marked changed along with it.
+ */
+typedef struct FiringStream {
+    std::shared_ptr<IsStreamData> stream_data;
+    std::shared_ptr<NodeData> node_data;
+
+    FiringStream(std::shared_ptr<IsStreamData> stream_data, std::shared_ptr<NodeData> node_data)
+    : stream_data(std::move(stream_data)), node_data(std::move(node_data)) {}
+} FiringStream;
+
+/**
+ * Running totals kept by a SodiumCtx, for monitoring. The counters are always
+ * kept. The phase times and the histogram read the clock several times per
+ * transaction, so they are only kept while detailed is set.
+ */
+typedef struct SodiumStats {
+    // Outermost transactions ended.
+    unsigned long transactions;
+    // Nodes visited in rank order or brought up to date by update_node().
+    unsigned long node_visits;
+    // Node update functions run.
+    unsigned long node_updates;
+    unsigned long pre_eot_callbacks;
+    unsigned long pre_post_callbacks;
+    unsigned long post_callbacks;
+    bool detailed;
+    std::chrono::nanoseconds pre_eot_time;
+    std::chrono::nanoseconds propagate_time;
+    std::chrono::nanoseconds pre_post_time;
+    std::chrono::nanoseconds reset_time;
+    std::chrono::nanoseconds post_time;
+    // Transactions by the number of node updates they ran: bucket 0 counts
+    // those with none, and bucket i those with 2^(i-1) up to 2^i - 1.
+    std::array<unsigned long, 32> node_updates_histogram;
+
+    SodiumStats()
+    : transactions(0), node_visits(0), node_updates(0),
+      pre_eot_callbacks(0), pre_post_callbacks(0), post_callbacks(0),
+      detailed(false), pre_eot_time(0), propagate_time(0), pre_post_time(0),
+      reset_time(0), post_time(0) {
+        this->node_updates_histogram.fill(0);
+    }
+} SodiumStats;
+
 struct SodiumCtxData {
-    std::vector<std::unique_ptr<IsNode>> changed_nodes;
-    std::vector<std::unique_ptr<IsNode>> visited_nodes;
+    // The SodiumCtx handles to this context. Atomic because a handle may be
+    // copied on another thread by StreamSink::enqueue().
+    std::atomic<unsigned int> ref_count;
+    GcCtx gc_ctx;
+    unsigned int node_count;
+    unsigned int node_ref_count;
+    std::vector<std::shared_ptr<NodeData>> changed_nodes;
+    std::vector<std::shared_ptr<NodeData>> visited_nodes;
+    std::vector<FiringStream> firing_streams;
+    std::vector<PrioritizedNode> prioritized;
+    unsigned int prioritized_seq;
+    bool to_regen;
     unsigned int transaction_depth;
     unsigned int callback_depth;
     std::vector<std::function<void()>> pre_eot;
     std::vector<std::function<void()>> pre_post;
     std::vector<std::function<void()>> post;
+    // Strong listeners. Each knows its index here, so it can be removed
+    // without a search.
     std::vector<Listener> keep_alive;
     unsigned int allow_collect_cycles_counter;
+#ifdef SODIUM_TRACK_LIVING_NODES
+    std::unordered_set<NodeData*> living_nodes;
+#endif
+    // Sends queued from other threads, waiting for drain_inbox().
+    Inbox inbox;
+    SodiumStats stats;
 };
 
 class InCallback;
 
+/**
+ * A handle to a context: a single pointer with a count kept in the context
+ * itself, so copying one into every node, stream and closure costs one
+ * increment. Everything that belongs to the context lives in SodiumCtxData.
+ */
 typedef struct SodiumCtx {
-    std::shared_ptr<SodiumCtxData> data;
-    GcCtx _gc_ctx;
-    std::shared_ptr<unsigned int> node_count;
-    std::shared_ptr<unsigned int> node_ref_count;
+    SodiumCtxData* data;
 
+    /**
+     * Makes a new context.
+     */
     SodiumCtx();
 
-    GcCtx gc_ctx() const;
+    /**
+     * A handle to no context, for members that are assigned one later.
+     */
+    explicit SodiumCtx(std::nullptr_t): data(nullptr) {}
+
+    SodiumCtx(const SodiumCtx& other): data(other.data) {
+        if (this->data != nullptr) {
+            this->data->ref_count.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    SodiumCtx(SodiumCtx&& other) noexcept: data(other.data) {
+        other.data = nullptr;
+    }
+
+    SodiumCtx& operator=(SodiumCtx other) {
+        std::swap(this->data, other.data);
+        return *this;
+    }
+
+    ~SodiumCtx();
+
+    GcCtx& gc_ctx() const {
+        return this->data->gc_ctx;
+    }
+
+    const std::shared_ptr<Slab>& slab() const;
 
     Node null_node() const;
 
-    void inc_node_count() const;
+    void inc_node_count() const {
+        ++this->data->node_count;
+    }
+
+    void dec_node_count() const {
+        --this->data->node_count;
+    }
+
+    unsigned int num_nodes() const {
+        return this->data->node_count;
+    }
 
-    void dec_node_count() const;
+    void inc_node_ref_count() const {
+#ifdef SODIUM_TRACK_LIVING_NODES
+        ++this->data->node_ref_count;
+#endif
+    }
 
-    void inc_node_ref_count() const;
+    void dec_node_ref_count() const {
+#ifdef SODIUM_TRACK_LIVING_NODES
+        --this->data->node_ref_count;
+#endif
+    }
 
-    void dec_node_ref_count() const;
+    void reset_num_nodes() const;
 
     template<typename K>
     typename std::result_of<K()>::type transaction(K k) const {
@@ -68,7 +215,7 @@ typedef struct SodiumCtx {
 
     template<typename K>
     void transaction_void(K k) const {
-        this->transaction([k]() mutable { k(); return 0; });
+        this->transaction([&k]() { k(); return 0; });
     }
 
     void add_dependents_to_changed_nodes(IsNode& node);
@@ -91,12 +238,38 @@ typedef struct SodiumCtx {
         this->data->post.push_back(std::function<void()>(k));
     }
 
+    void reset_firing_at_end(std::shared_ptr<IsStreamData> stream_data, std::shared_ptr<NodeData> node_data) const;
+
     void end_of_transaction() const;
 
     void update_node(const Node& node) const;
 
+    void prioritize(const std::shared_ptr<NodeData>& node_data) const;
+
+    void visit_node(const std::shared_ptr<NodeData>& node_data) const;
+
+    void fire_node(const std::shared_ptr<NodeData>& node_data) const;
+
     void collect_cycles() const;
 
+    const SodiumStats& stats() const {
+        return this->data->stats;
+    }
+
+    /**
+     * Switches the phase times and histogram of stats() on or off.
+     */
+    void set_detailed_stats(bool detailed) const {
+        this->data->stats.detailed = detailed;
+    }
+
+    /**
+     * Runs the sends queued in the inbox so far, either all in one
+     * transaction or each in its own. Must be called on the thread that owns
+     * this context. Returns the number of sends run.
+     */
+    unsigned int drain_inbox(bool transaction_per_item) const;
+
     void add_listener_to_keep_alive(const Listener& l) const;
 
     void remove_listener_from_keep_alive(const Listener& l) const;
@@ -118,6 +291,48 @@ public:
     }
 };
 
+/**
+ * Holds off cycle collection at the end of transactions while it exists, even
+ * if an exception leaves the scope early.
+ */
+class HoldCollectCycles {
+public:
+    SodiumCtx _sodium_ctx;
+
+    HoldCollectCycles(const SodiumCtx& sodium_ctx): _sodium_ctx(sodium_ctx) {
+        ++this->_sodium_ctx.data->allow_collect_cycles_counter;
+    }
+
+    ~HoldCollectCycles() {
+        --this->_sodium_ctx.data->allow_collect_cycles_counter;
+    }
+};
+
+/**
+ * The context the public API uses on the calling thread. This is the context
+ * of the innermost SodiumCtxScope on this thread, or otherwise a context that
+ * belongs to the thread, so graphs built on different threads never share
+ * any state.
+ */
+SodiumCtx& current_sodium_ctx();
+
+/**
+ * Makes a context current on this thread until the scope is destroyed.
+ */
+class SodiumCtxScope {
+private:
+    SodiumCtx* previous;
+
+    SodiumCtxScope(const SodiumCtxScope&);
+
+    SodiumCtxScope& operator=(const SodiumCtxScope&);
+
+public:
+    SodiumCtxScope(SodiumCtx& sodium_ctx);
+
+    ~SodiumCtxScope();
+};
+
 typedef struct Transaction {
     SodiumCtx sodium_ctx;
     bool is_closed = false;
@@ -13,18 +13,64 @@ namespace sodium {
 namespace impl {
 
 template <typename A>
-class StreamData {
+class StreamData: public IsStreamData {
 public:
-    boost::optional<std::shared_ptr<A>> firing_op;
-    SodiumCtx sodium_ctx;
+    // Held in place, so firing does not allocate.
+    boost::optional<A> firing_op;
+    // The firing once moved out for holds by publish(), shared by every hold
+    // of this stream until the firing is reset.
+    std::shared_ptr<A> published;
+    // Assigned by Stream::mkStream. Starts empty so that making the stream
+    // does not make a context.
+    SodiumCtx sodium_ctx = SodiumCtx(nullptr);
+    // The node this stream fires from, set by Stream::mkStream. Whoever fires
+    // the stream holds a reference to the node, so this cannot dangle.
+    NodeData* node_data;
     boost::optional<std::function<A(const A&,const A&)>> coalescer_op;
     std::vector<std::function<void()>> cleanups;
 
-    ~StreamData() {
+    virtual ~StreamData() {
         for (auto cleanup = cleanups.begin(); cleanup != cleanups.end(); ++cleanup) {
             (*cleanup)();
         }
     }
+
+    virtual void reset_firing() {
+        this->firing_op = boost::none;
+        this->published.reset();
+    }
+
+    /**
+     * Moves the firing out into shared, immutable storage for the cells that
+     * hold this stream. Only valid once every node has seen the firing.
+     */
+    std::shared_ptr<A> publish() {
+        if (!this->published) {
+            this->published = std::unique_ptr<A>(new A(std::move(*this->firing_op)));
+        }
+        return this->published;
+    }
+
+    /**
+     * Fires the stream within the current transaction. Operator nodes call
+     * this on their output directly, rather than going through a Stream
+     * handle.
+     */
+    void fire(A a) {
+        bool is_first = !(bool)this->firing_op;
+        if (this->coalescer_op && !is_first) {
+            std::function<A(const A&, const A&)>& coalescer = *this->coalescer_op;
+            A& firing = *this->firing_op;
+            A firing2 = coalescer(firing, std::move(a));
+            this->firing_op.emplace(std::move(firing2));
+        } else {
+            this->firing_op.emplace(std::move(a));
+        }
+        this->node_data->changed = true;
+        if (is_first) {
+            this->sodium_ctx.reset_firing_at_end(this->shared_from_this(), this->node_data->shared_from_this());
+        }
+    }
 };
 
 template <typename A>
@@ -70,6 +116,9 @@ public:
     template <typename MK_NODE>
     static Stream<A> mkStream(const SodiumCtx& sodium_ctx, MK_NODE mk_node);
 
+    template <typename MK_NODE>
+    static Stream<A> mkStream(const SodiumCtx& sodium_ctx, std::shared_ptr<StreamData<A>> stream_data, MK_NODE mk_node);
+
     virtual const Node& node() const {
         return this->_node;
     }
@@ -108,6 +157,9 @@ public:
     template <typename FN>
     Stream<A> merge(const Stream<A>& s2, FN fn) const;
 
+    template <typename FN>
+    static Stream<A> merge_all(const std::vector<Stream<A>>& sas, FN fn);
+
     Cell<A> hold(const A& a) const {
         return this->hold_lazy(Lazy<A>::of_value(a));
     }
@@ -126,6 +178,12 @@ public:
     template <typename S, typename FN>
     Cell<S> accum_lazy(Lazy<S> init_state, FN fn) const;
 
+    template <typename S, typename FN>
+    Stream<S> accum_s_lazy(Lazy<S> init_state, FN fn) const;
+
+    template <typename FN>
+    Stream<A> coalesce(FN fn) const;
+
     Stream<A> defer() const;
 
     static Stream<A> split(const Stream<std::list<A>>& sxa);
@@ -143,31 +201,8 @@ public:
 
     void _send(A a) {
         SodiumCtx sodium_ctx = this->sodium_ctx();
-        sodium_ctx.transaction_void([this, sodium_ctx, a]() mutable {
-            bool is_first = !(bool)this->data->firing_op;
-            if (this->data->coalescer_op) {
-                std::function<A(const A&, const A&)>& coalescer = *this->data->coalescer_op;
-                if (this->data->firing_op) {
-                    A& firing = **this->data->firing_op;
-                    A firing2 = coalescer(firing, std::move(a));
-                    boost::optional<std::shared_ptr<A>> firing_op = boost::optional<std::shared_ptr<A>>(std::unique_ptr<A>(new A(firing2)));
-                    this->data->firing_op = firing_op;
-                } else {
-                    boost::optional<std::shared_ptr<A>> firing_op = boost::optional<std::shared_ptr<A>>(std::unique_ptr<A>(new A(std::move(a))));
-                    this->data->firing_op = firing_op;
-                }
-            } else {
-                boost::optional<std::shared_ptr<A>> firing_op = boost::optional<std::shared_ptr<A>>(std::unique_ptr<A>(new A(std::move(a))));
-                this->data->firing_op = firing_op;
-            }
-            this->node().data->changed = true;
-            if (is_first) {
-                Stream<A> this_ = *this;
-                sodium_ctx.pre_post([this_]() {
-                    this_.data->firing_op = boost::none;
-                    this_.node().data->changed = false;
-                });
-            }
+        sodium_ctx.transaction_void([this, &a]() {
+            this->data->fire(std::move(a));
         });
     }
 
@@ -183,9 +218,9 @@ public:
                     this_.sodium_ctx(),
                     "Stream::map",
                     [this_, s]() {
-                        boost::optional<std::shared_ptr<A>>& firing_op = this_.data->firing_op;
+                        boost::optional<A>& firing_op = this_.data->firing_op;
                         if (firing_op) {
-                            s.unwrap()._send(**firing_op);
+                            s.send(*firing_op);
                         }
                     },
                     std::move(dependencies)
@@ -249,8 +284,11 @@ template <typename A>
 class StreamWeakForwardRef {
 public:
     std::shared_ptr<std::vector<WeakStream<A>>> data;
+    // Held strongly so that send() needs no upgrade. The node's update owns
+    // this, and the stream data does not own the node, so there is no cycle.
+    std::shared_ptr<StreamData<A>> stream_data;
 
-    StreamWeakForwardRef() {
+    StreamWeakForwardRef(std::shared_ptr<StreamData<A>> stream_data): stream_data(stream_data) {
         this->data = std::unique_ptr<std::vector<WeakStream<A>>>(
             new std::vector<WeakStream<A>>()
         );
@@ -267,6 +305,13 @@ public:
         boost::optional<Stream<A>> s2 = s.upgrade2();
         return *s2;
     }
+
+    /**
+     * Fires the stream from inside its node's update.
+     */
+    void send(A a) const {
+        this->stream_data->fire(std::move(a));
+    }
 };
 
 }
@@ -13,26 +13,25 @@ namespace impl {
 template <typename A>
 template <typename MK_NODE>
 Stream<A> Stream<A>::mkStream(const SodiumCtx& sodium_ctx, MK_NODE mk_node) {
-    StreamWeakForwardRef<A> stream_weak_forward_ref;
+    return Stream<A>::mkStream(sodium_ctx, slab_make_shared<StreamData<A>>(sodium_ctx.slab()), mk_node);
+}
+
+template <typename A>
+template <typename MK_NODE>
+Stream<A> Stream<A>::mkStream(const SodiumCtx& sodium_ctx, std::shared_ptr<StreamData<A>> stream_data, MK_NODE mk_node) {
+    stream_data->firing_op = boost::none;
+    stream_data->sodium_ctx = sodium_ctx;
+    stream_data->node_data = nullptr;
+    stream_data->coalescer_op = boost::none;
+    StreamWeakForwardRef<A> stream_weak_forward_ref(stream_data);
     Node node = mk_node(stream_weak_forward_ref);
-    std::shared_ptr<StreamData<A>> stream_data;
-    {
-        StreamData<A>* _stream_data = new StreamData<A>();
-        _stream_data->firing_op = boost::none;
-        _stream_data->sodium_ctx = sodium_ctx;
-        _stream_data->coalescer_op = boost::none;
-        stream_data = std::unique_ptr<StreamData<A>>(_stream_data);
-    }
+    stream_data->node_data = node.data.get();
     Stream<A> s(stream_data, node);
     stream_weak_forward_ref = s;
     sodium_ctx.pre_eot([sodium_ctx, s, node]() {
         (node.data->update)();
         if (s.data->firing_op) {
             node.data->changed = true;
-            sodium_ctx.pre_post([s]() {
-                s.data->firing_op = boost::none;
-                s._node.data->changed = false;
-            });
         }
     });
     return s;
@@ -60,9 +59,9 @@ Stream<typename std::result_of<FN(const A&)>::type> Stream<A>::map(FN fn) const
                 this_.sodium_ctx(),
                 "Stream::map",
                 [this_, s, fn]() {
-                    boost::optional<std::shared_ptr<A>>& firing_op = this_.data->firing_op;
+                    boost::optional<A>& firing_op = this_.data->firing_op;
                     if (firing_op) {
-                        s.unwrap()._send(fn(**firing_op));
+                        s.send(fn(*firing_op));
                     }
                 },
                 std::move(dependencies)
@@ -89,9 +88,9 @@ Stream<A> Stream<A>::filter(PRED pred) const {
                 "Stream::filter",
                 [this_, s, pred]() {
                     if (this_.data->firing_op) {
-                        A& firing = **this_.data->firing_op;
+                        A& firing = *this_.data->firing_op;
                         if (pred(firing)) {
-                            s.unwrap()._send(firing);
+                            s.send(firing);
                         }
                     }
                 },
@@ -124,20 +123,20 @@ Stream<A> Stream<A>::merge(const Stream<A>& s2, FN fn) const {
                 this_.sodium_ctx(),
                 "Stream::merge",
                 [this_, s2, s, fn]() {
-                    boost::optional<std::shared_ptr<A>>& firing1_op = this_.data->firing_op;
-                    boost::optional<std::shared_ptr<A>>& firing2_op = s2.data->firing_op;
+                    boost::optional<A>& firing1_op = this_.data->firing_op;
+                    boost::optional<A>& firing2_op = s2.data->firing_op;
                     if (firing1_op) {
-                        A& firing1 = **firing1_op;
+                        A& firing1 = *firing1_op;
                         if (firing2_op) {
-                            A& firing2 = **firing2_op;
-                            s.unwrap()._send(fn(firing1, firing2));
+                            A& firing2 = *firing2_op;
+                            s.send(fn(firing1, firing2));
                         } else {
-                            s.unwrap()._send(firing1);
+                            s.send(firing1);
                         }
                     } else {
                         if (firing2_op) {
-                            A& firing2 = **firing2_op;
-                            s.unwrap()._send(firing2);
+                            A& firing2 = *firing2_op;
+                            s.send(firing2);
                         }
                     }
                 },
@@ -151,6 +150,67 @@ Stream<A> Stream<A>::merge(const Stream<A>& s2, FN fn) const {
     );
 }
 
+/**
+ * Combine the firings of sas[start..end) into out, splitting the range the
+ * same way the pairwise merge tree used to, so that a non-associative fn sees
+ * exactly the same arguments in the same order.
+ */
+template <typename A, typename FN>
+bool merge_firings(const std::vector<Stream<A>>& sas, size_t start, size_t end, const FN& fn, boost::optional<A>& out) {
+    size_t len = end - start;
+    if (len == 1) {
+        boost::optional<A>& firing_op = sas[start].data->firing_op;
+        if (firing_op) {
+            out = *firing_op;
+            return true;
+        }
+        return false;
+    }
+    size_t mid = (start + end) / 2;
+    if (!merge_firings(sas, start, mid, fn, out)) {
+        return merge_firings(sas, mid, end, fn, out);
+    }
+    boost::optional<A> right;
+    if (merge_firings(sas, mid, end, fn, right)) {
+        out = fn(*out, *right);
+    }
+    return true;
+}
+
+template <typename A>
+template <typename FN>
+Stream<A> Stream<A>::merge_all(const std::vector<Stream<A>>& sas, FN fn) {
+    if (sas.size() == 1) {
+        return sas[0];
+    }
+    return Stream::mkStream(
+        sas[0].sodium_ctx(),
+        [sas, fn](StreamWeakForwardRef<A> s) {
+            std::vector<Dep> fn_deps = GetDeps<FN>::call(fn);
+            std::vector<std::unique_ptr<IsNode>> dependencies;
+            for (const Stream<A>& sa : sas) {
+                dependencies.push_back(sa.box_clone());
+            }
+            Node node = Node::mk_node(
+                sas[0].sodium_ctx(),
+                "Stream::merge_all",
+                [sas, s, fn]() {
+                    boost::optional<A> firing_op;
+                    if (merge_firings(sas, 0, sas.size(), fn, firing_op)) {
+                        s.send(std::move(*firing_op));
+                    }
+                },
+                std::move(dependencies)
+            );
+            node.add_update_dependencies(fn_deps);
+            for (const Stream<A>& sa : sas) {
+                node.add_update_dependency(sa.to_dep());
+            }
+            return node;
+        }
+    );
+}
+
 template <typename A>
 Cell<A> Stream<A>::hold_lazy(Lazy<A> a) const {
     SodiumCtx sodium_ctx = this->sodium_ctx();
@@ -159,6 +219,27 @@ Cell<A> Stream<A>::hold_lazy(Lazy<A> a) const {
     });
 }
 
+/**
+ * The state of an accumulating node, held in place. The initial state is only
+ * sampled when the first event arrives.
+ */
+template <typename S>
+class AccumState {
+public:
+    Lazy<S> init_state;
+    boost::optional<S> state_op;
+
+    AccumState(Lazy<S> init_state): init_state(init_state) {}
+
+    S& sample() {
+        if (!this->state_op) {
+            const Lazy<S>& init_state = this->init_state;
+            this->state_op = *init_state;
+        }
+        return *this->state_op;
+    }
+};
+
 template <typename A>
 template <typename S, typename FN>
 Stream<typename std::tuple_element<
@@ -166,31 +247,144 @@ Stream<typename std::tuple_element<
 Stream<A>::collect_lazy(Lazy<S> init_state, FN fn) const {
     typedef typename std::tuple_element<
         0, typename std::result_of<FN(A, S)>::type>::type B;
-    SodiumCtx sodium_ctx = this->sodium_ctx();
-    Stream<A> sa = *this;
-    return this->sodium_ctx().transaction([sodium_ctx, sa, init_state, fn]() {
-        StreamLoop<S> ssl(sodium_ctx);
-        Cell<S> cs = ssl.stream().hold_lazy(init_state);
-        Stream<std::tuple<B,S>> sbs = sa.snapshot(cs, fn);
-        Stream<B> sb = sbs.map([](const std::tuple<B,S> x) { return std::get<0>(x); });
-        Stream<S> ss = sbs.map([](const std::tuple<B,S> x) { return std::get<1>(x); });
-        ssl.loop(ss);
-        return sb;
-    });
+    Stream<A> this_ = *this;
+    return Stream<B>::mkStream(
+        this->sodium_ctx(),
+        [this_, init_state, fn](StreamWeakForwardRef<B> s) {
+            std::shared_ptr<AccumState<S>> state = slab_make_shared<AccumState<S>>(this_.sodium_ctx().slab(), init_state);
+            std::vector<Dep> fn_deps = GetDeps<FN>::call(fn);
+            std::vector<std::unique_ptr<IsNode>> dependencies;
+            dependencies.push_back(this_.box_clone());
+            Node node = Node::mk_node(
+                this_.sodium_ctx(),
+                "Stream::collect",
+                [this_, s, fn, state]() {
+                    boost::optional<A>& firing_op = this_.data->firing_op;
+                    if (firing_op) {
+                        S& current_state = state->sample();
+                        std::tuple<B,S> result = fn(*firing_op, current_state);
+                        current_state = std::move(std::get<1>(result));
+                        s.send(std::move(std::get<0>(result)));
+                    }
+                },
+                std::move(dependencies)
+            );
+            node.add_update_dependency(this_.to_dep());
+            node.add_update_dependencies(fn_deps);
+            return node;
+        }
+    );
 }
 
+/**
+ * The output stream of an accum cell. Once the transaction is over, the
+ * state it fired is moved into the cell's value, in place when nothing else
+ * holds on to the old value.
+ */
+template <typename S>
+class AccumStreamData: public StreamData<S> {
+public:
+    Lazy<std::shared_ptr<S>> value;
+
+    AccumStreamData(Lazy<std::shared_ptr<S>> value): value(value) {}
+
+    virtual void reset_firing() {
+        if (this->published) {
+            // A hold of this stream already took the firing, so share it.
+            *this->value.data->value_op = this->published;
+        } else if (this->firing_op) {
+            std::shared_ptr<S>& state = *this->value.data->value_op;
+            if (state.use_count() == 1) {
+                *state = std::move(*this->firing_op);
+            } else {
+                state = std::unique_ptr<S>(new S(std::move(*this->firing_op)));
+            }
+        }
+        this->firing_op = boost::none;
+        this->published.reset();
+    }
+};
+
 template <typename A>
 template <typename S, typename FN>
 Cell<S> Stream<A>::accum_lazy(Lazy<S> init_state, FN fn) const {
     SodiumCtx sodium_ctx = this->sodium_ctx();
-    Stream<A> sa = *this;
-    return this->sodium_ctx().transaction([sodium_ctx, sa, init_state, fn]() {
-        StreamLoop<S> ssl(sodium_ctx);
-        Cell<S> cs = ssl.stream().hold_lazy(init_state);
-        Stream<S> ss = sa.snapshot(cs, fn);
-        ssl.loop(ss);
-        return cs;
+    Stream<A> this_ = *this;
+    // Shared between the cell, its output stream and the node, so the state
+    // can be replaced under all of them at once.
+    Lazy<std::shared_ptr<S>> value([init_state]() {
+        return std::shared_ptr<S>(std::unique_ptr<S>(new S(*init_state)));
     });
+    Stream<S> ss = Stream<S>::mkStream(
+        sodium_ctx,
+        slab_make_shared<AccumStreamData<S>>(sodium_ctx.slab(), value),
+        [this_, value, fn](StreamWeakForwardRef<S> s) {
+            std::vector<Dep> fn_deps = GetDeps<FN>::call(fn);
+            std::vector<std::unique_ptr<IsNode>> dependencies;
+            dependencies.push_back(this_.box_clone());
+            Node node = Node::mk_node(
+                this_.sodium_ctx(),
+                "Stream::accum",
+                [this_, s, fn, value]() {
+                    boost::optional<A>& firing_op = this_.data->firing_op;
+                    if (firing_op) {
+                        const S& state = **value;
+                        s.send(fn(*firing_op, state));
+                    }
+                },
+                std::move(dependencies)
+            );
+            node.add_update_dependency(this_.to_dep());
+            node.add_update_dependencies(fn_deps);
+            return node;
+        }
+    );
+    std::shared_ptr<CellData<S>> cell_data = slab_make_shared<CellData<S>>(
+        sodium_ctx.slab(),
+        ss,
+        value
+    );
+    return Cell<S>(cell_data, ss._node);
+}
+
+template <typename A>
+template <typename S, typename FN>
+Stream<S> Stream<A>::accum_s_lazy(Lazy<S> init_state, FN fn) const {
+    Stream<A> this_ = *this;
+    return Stream<S>::mkStream(
+        this->sodium_ctx(),
+        [this_, init_state, fn](StreamWeakForwardRef<S> s) {
+            std::shared_ptr<AccumState<S>> state = slab_make_shared<AccumState<S>>(this_.sodium_ctx().slab(), init_state);
+            std::vector<Dep> fn_deps = GetDeps<FN>::call(fn);
+            std::vector<std::unique_ptr<IsNode>> dependencies;
+            dependencies.push_back(this_.box_clone());
+            Node node = Node::mk_node(
+                this_.sodium_ctx(),
+                "Stream::accum_s",
+                [this_, s, fn, state]() {
+                    boost::optional<A>& firing_op = this_.data->firing_op;
+                    if (firing_op) {
+                        S& current_state = state->sample();
+                        S next_state = fn(*firing_op, current_state);
+                        current_state = std::move(next_state);
+                        s.send(current_state);
+                    }
+                },
+                std::move(dependencies)
+            );
+            node.add_update_dependency(this_.to_dep());
+            node.add_update_dependencies(fn_deps);
+            return node;
+        }
+    );
+}
+
+template <typename A>
+template <typename FN>
+Stream<A> Stream<A>::coalesce(FN) const {
+    // A stream fires at most once per transaction, as fire() overwrites or
+    // combines at the source, so there is never anything to fold here.
+    return *this;
 }
 
 template <typename A>
@@ -233,7 +427,7 @@ Stream<A> Stream<A>::split(const Stream<std::list<A>>& sxa) {
             [keep_alive]() {
                 *keep_alive = boost::none;
             },
-            [keep_alive](std::function<Tracer> tracer) {
+            [keep_alive](std::function<Tracer>& tracer) {
                 if (*keep_alive) {
                     tracer((*keep_alive)->gc_node);
                 }
@@ -258,13 +452,13 @@ Stream<A> Stream<A>::once() const {
                 "Stream::once",
                 [sodium_ctx, this_, s]() {
                     if (this_.data->firing_op) {
-                        A& firing = **this_.data->firing_op;
+                        A& firing = *this_.data->firing_op;
+                        s.send(firing);
                         Stream<A> s2 = s.unwrap();
-                        s2._send(firing);
                         sodium_ctx.post([s2]() mutable {
-                            std::vector<std::unique_ptr<IsNode>> deps = box_clone_vec_is_node(s2.node().data->dependencies);
-                            for (auto dep = deps.begin(); dep != deps.end(); ++dep) {
-                                s2.remove_dependency(**dep);
+                            NodeData& node_data = *s2.node().data;
+                            while (node_data.dependencies.size() != 0) {
+                                remove_dependency_edge(node_data, node_data.dependencies.size() - 1);
                             }
                         });
                     }
@@ -289,7 +483,7 @@ Listener Stream<A>::_listen(K k, bool is_weak) const {
         "Stream::listen",
         [this_, k]() {
             if (this_.data->firing_op) {
-                A& firing = **this_.data->firing_op;
+                A& firing = *this_.data->firing_op;
                 InCallback in_callback = this_.sodium_ctx().in_callback();
                 k(firing);
             }
@@ -38,7 +38,7 @@ StreamLoop<A> StreamLoop<A>::mkStreamLoop(const SodiumCtx& sodium_ctx) {
         }
         stream_loop_data->stream = Stream<A>(sodium_ctx);
     };
-    auto gc_node_trace = [weak_stream_loop_data, sodium_ctx](std::function<Tracer> tracer) {
+    auto gc_node_trace = [weak_stream_loop_data, sodium_ctx](std::function<Tracer>& tracer) {
         std::shared_ptr<StreamLoopData<A>> stream_loop_data = weak_stream_loop_data.lock();
         if (!stream_loop_data) {
             return;
@@ -87,11 +87,11 @@ void StreamLoop<A>::loop(const Stream<A>& s) {
     this->data->looped = true;
     this->data->stream.node().add_dependency(s);
     this->data->stream.node().add_update_dependency(s.to_dep());
-    WeakStream<A> s_out = this->data->stream.downgrade2();
+    std::shared_ptr<StreamData<A>> s_out = this->data->stream.data;
     this->data->stream.node().data->update = [s, s_out]() mutable {
         if (s.data->firing_op) {
-            A& firing = **s.data->firing_op;
-            (*s_out.upgrade2())._send(firing);
+            A& firing = *s.data->firing_op;
+            s_out->fire(firing);
         }
     };
 }
@@ -29,15 +29,61 @@ public:
     }
 
     void send(A a) const {
+        this->_sodium_ctx.transaction_void([this, &a]() {
+            this->fire(std::move(a));
+        });
+    }
+
+    /**
+     * Sends every value in [begin, end) in one transaction.
+     */
+    template <typename IT>
+    void send_all(IT begin, IT end) const {
         StreamSink<A> this_ = *this;
-        this->_sodium_ctx.transaction_void([this_, a]() mutable {
-            this_._stream.node().data->changed = true;
-            this_._sodium_ctx.data->changed_nodes.push_back(this_._stream.box_clone());
-            this_._stream._send(a);
+        this->_sodium_ctx.transaction_void([&this_, &begin, &end]() {
+            for (; begin != end; ++begin) {
+                this_.fire(*begin);
+            }
         });
     }
 
+    /**
+     * Sends each value in [begin, end) in a transaction of its own, holding
+     * off cycle collection until the last one has ended. Inside an open
+     * transaction every value joins that transaction instead.
+     */
+    template <typename IT>
+    void send_each(IT begin, IT end) const {
+        StreamSink<A> this_ = *this;
+        {
+            HoldCollectCycles hold(this->_sodium_ctx);
+            for (; begin != end; ++begin) {
+                this->_sodium_ctx.transaction_void([&this_, &begin]() {
+                    this_.fire(*begin);
+                });
+            }
+        }
+        // Inside an open transaction, collection waits for its end.
+        if (this->_sodium_ctx.data->allow_collect_cycles_counter == 0 &&
+            this->_sodium_ctx.data->transaction_depth == 0) {
+            this->_sodium_ctx.gc_ctx().collect_cycles_at_end_of_transaction();
+        }
+    }
+
+    /**
+     * Fires the sink within the current transaction. The node only goes on
+     * the changed list for the first value of a transaction.
+     */
+    void fire(A a) const {
+        if (!this->_stream.data->firing_op) {
+            this->_sodium_ctx.data->changed_nodes.push_back(this->_stream.node().data);
+        }
+        this->_stream.data->fire(std::move(a));
+    }
+
     WeakStreamSink<A> downgrade() const;
+
+    void enqueue(A a) const;
 };
 
 template <typename A>
@@ -67,6 +113,19 @@ WeakStreamSink<A> StreamSink<A>::downgrade() const {
     return WeakStreamSink<A>(stream, sodium_ctx);
 }
 
+// Safe to call from any thread: taking weak references does not touch the
+// GC ref counts, which belong to the thread that owns the context.
+template <typename A>
+void StreamSink<A>::enqueue(A a) const {
+    WeakStreamSink<A> weak_ss = this->downgrade();
+    this->_sodium_ctx.data->inbox.push([weak_ss, a]() {
+        boost::optional<StreamSink<A>> ss_op = weak_ss.upgrade();
+        if (ss_op) {
+            ss_op->send(a);
+        }
+    });
+}
+
 }
 
 }
@@ -4,57 +4,17 @@
 #define _SODIUM_ROUTER_H_
 
 #include <sodium/sodium.h>
-#include <map>
+#include <sodium/impl/router.h>
+#include <tuple>
+#include <vector>
 
 namespace sodium {
     namespace impl {
-        template <typename Selector>
-        struct routing_table {
-            routing_table(const impl::stream_& stream_, SODIUM_SHARED_PTR<impl::node> node_)
-            : node(node_),
-              kill(NULL)
-            {}
-            ~routing_table() {
-                if (kill != NULL) {
-                    (*kill)();
-                    delete kill;
-                }
-            }
-            SODIUM_SHARED_PTR<impl::node> node;
-            std::function<void()>* kill;
-            std::multimap<Selector, SODIUM_SHARED_PTR<impl::node>> table;
-        };
-
         template <typename A, typename Selector>
         struct router_impl {
-            SODIUM_SHARED_PTR<routing_table<Selector>> table;
+            boost::optional<Router<A, Selector>> router;
             std::vector<std::tuple<stream_loop<A>, Selector>> queued;
         };
-
-        template <typename A, typename Selector>
-        struct router_handler : listen_handler
-        {
-            router_handler(
-                std::function<Selector(const A&)> f_,
-                SODIUM_SHARED_PTR<routing_table<Selector>> table_)
-            : f(std::move(f_)),
-              table(std::move(table_))
-            {
-            }
-            std::function<Selector(const A&)> f;
-            SODIUM_SHARED_PTR<routing_table<Selector>> table;
-            virtual void handle(const SODIUM_SHARED_PTR<node>& target, transaction_impl* trans, const light_ptr& a)
-            {
-                Selector sel = f(*a.cast_ptr<A>(NULL));
-                std::vector<SODIUM_SHARED_PTR<impl::node>> targets;
-                for (auto it = table->table.lower_bound(sel);
-                        it != table->table.end() && it->first == sel;
-                        ++it)
-                    targets.push_back(it->second);
-                for (auto it = targets.begin(); it != targets.end(); ++it)
-                    send(*it, trans, a);
-            }
-        };
     }  // end namespace impl
 
     template <typename A, typename Selector>
@@ -81,7 +41,10 @@ namespace sodium {
      *    stream<A> r3 = r.filter_equals(3);
      *
      * It is then far more efficient because the routing decision is implemented as
-     * a map look-up - O(logN)
+     * a hash look-up - O(1) - and an event only wakes the streams for its key.
+     * Selector must be hashable with std::hash.
+     *
+     * A stream from filter_equals() stops being routed to once it is destroyed.
      */
     template <typename A, typename Selector>
     class router
@@ -98,39 +61,12 @@ namespace sodium {
             router(stream<A> in, std::function<Selector(const A&)> f)
             : impl(new impl::router_impl<A, Selector>)
             {
-                SODIUM_TUPLE<impl::stream_,SODIUM_SHARED_PTR<impl::node> > p = impl::unsafe_new_stream();
-                auto stream = std::get<0>(p);
-                auto target = std::get<1>(p);
-                transaction trans1;
-                impl->table = SODIUM_SHARED_PTR<impl::routing_table<Selector>>(new impl::routing_table<Selector>(stream, target));
-                auto table(impl->table);
-                table->kill = in.listen_raw(trans1.impl(), target,
-                    new impl::router_handler<A, Selector>(f, table), false);
+                impl->router = impl::Router<A, Selector>::mkRouter(in.impl_, f);
             }
 
-            stream<A> filter_equals(Selector sel) const {
-                if (impl->table) {
-                    SODIUM_TUPLE<impl::stream_,SODIUM_SHARED_PTR<impl::node> > p = impl::unsafe_new_stream();
-                    auto target = std::get<1>(p);
-                    auto table(impl->table);
-    
-                    transaction trans1;
-    
-                    auto it = table->table.insert(std::make_pair(sel, target));
-                    if (table->node->link(NULL, target))
-                        trans1.impl()->to_regen = true;
-    
-                    stream<A> out(stream<A>(std::get<0>(p)).unsafe_add_cleanup(
-                        new std::function<void()>([table, it] () {
-                            impl::transaction_ trans2;
-                            trans2.impl()->last([table, it] () {
-                                auto target2 = it->second;
-                                table->table.erase(it);
-                                table->node->unlink_by_target(target2);
-                            });
-                        })));
-                    trans1.close();
-                    return out;
+            stream<A> filter_equals(const Selector& sel) const {
+                if (impl->router) {
+                    return stream<A>(impl->router->filter_equals(sel));
                 }
                 else {
                     stream_loop<A> out;
@@ -148,14 +84,14 @@ namespace sodium {
 
             void loop(const router<A, Selector>& r) const {
                 sodium::transaction trans;
-                if (this->impl->table) {
+                if (this->impl->router) {
 #if defined(SODIUM_NO_EXCEPTIONS)
                     abort();
 #else
                     SODIUM_THROW("router_loop looped back more than once");
 #endif
                 }
-                this->impl->table = r.impl->table;
+                this->impl->router = r.impl->router;
                 for (auto it = this->impl->queued.begin(); it != this->impl->queued.end(); ++it)
                     std::get<0>(*it).loop(this->filter_equals(std::get<1>(*it)));
                 this->impl->queued.clear();
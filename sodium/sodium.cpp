@@ -2,22 +2,32 @@
 
 namespace sodium {
 
-namespace impl {
-    SodiumCtx sodium_ctx;
-}
-
 void reset_num_nodes() {
-    *impl::sodium_ctx.node_count = 0;
-    *impl::sodium_ctx.node_ref_count = 0;
-    impl::living_nodes.clear();
+    impl::current_sodium_ctx().reset_num_nodes();
 }
 
 void collect_cycles() {
-    impl::sodium_ctx.collect_cycles();
+    impl::current_sodium_ctx().collect_cycles();
 }
 
 int num_nodes() {
-    return *impl::sodium_ctx.node_count;
+    return impl::current_sodium_ctx().num_nodes();
+}
+
+unsigned int drain_inbox(drain_mode mode) {
+    return impl::current_sodium_ctx().drain_inbox(mode == drain_mode::transaction_per_item);
+}
+
+void set_collect_cycles_policy(const collect_cycles_policy& policy) {
+    impl::current_sodium_ctx().gc_ctx().set_config(policy.impl());
+}
+
+context_stats stats() {
+    return context_stats(impl::current_sodium_ctx());
+}
+
+void set_detailed_stats(bool detailed) {
+    impl::current_sodium_ctx().set_detailed_stats(detailed);
 }
 
 }
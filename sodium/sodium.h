@@ -2,6 +2,7 @@
 #define __SODIUM_SODIUM_H__
 
 #include "sodium/config.h"
+#include "sodium/context.h"
 #include "sodium/transaction.h"
 #include "sodium/impl/cell.h"
 #include "sodium/impl/cell_impl.h"
@@ -16,7 +17,10 @@
 #include "sodium/impl/stream_loop_impl.h"
 #include "sodium/impl/stream_sink.h"
 #include <boost/optional.hpp>
+#include <iterator>
 #include <list>
+#include <memory>
+#include <vector>
 
 #ifdef _WIN32
 // maybe replace this with c++14 attributes..
@@ -25,16 +29,23 @@
 
 namespace sodium {
 
-    namespace impl {
-        extern SodiumCtx sodium_ctx;
-    }
-
+    /*!
+     * These act on the current context of the calling thread.
+     */
     void reset_num_nodes();
     
     void collect_cycles();
 
     int num_nodes();
 
+    unsigned int drain_inbox(drain_mode mode = drain_mode::transaction_per_item);
+
+    void set_collect_cycles_policy(const collect_cycles_policy& policy);
+
+    context_stats stats();
+
+    void set_detailed_stats(bool detailed);
+
     template <typename A> class stream;
     template <typename A> class cell;
     template <typename A> class cell_sink;
@@ -125,9 +136,13 @@ namespace sodium {
         /*!
          * Constant value.
          */
-        cell(const A& a) : impl_(impl::sodium_ctx, a) {}
+        cell(const A& a) : impl_(impl::current_sodium_ctx(), a) {}
+
+        cell(A&& a) : impl_(impl::current_sodium_ctx(), std::move(a)) {}
+
+        cell(context& ctx, const A& a) : impl_(ctx.impl(), a) {}
 
-        cell(A&& a) : impl_(impl::sodium_ctx, std::move(a)) {}
+        cell(context& ctx, A&& a) : impl_(ctx.impl(), std::move(a)) {}
 
         /*!
          * Sample the value of this cell.
@@ -136,6 +151,15 @@ namespace sodium {
             return this->impl_.sample();
         }
 
+        /*!
+         * Sample the value of this cell without copying it. Cell values are
+         * never modified once published, so the returned value stays as it
+         * is after the cell moves on.
+         */
+        std::shared_ptr<const A> sample_ptr() const {
+            return this->impl_.sample_ptr();
+        }
+
         lazy<A> sample_lazy() const {
             impl::Lazy<A> value = this->impl_.sample_lazy();
             return lazy<A>([value]() -> A { return *value; });
@@ -168,14 +192,7 @@ namespace sodium {
         cell<typename std::result_of<Fn(A, B)>::type> lift(const cell<B>& bb,
                                                            const Fn& f) const {
             typedef typename std::result_of<Fn(A, B)>::type C;
-            std::function<std::function<C(const B&)>(const A&)> fa(
-                [f](const A& a) -> std::function<C(const B&)> {
-                    return [f, a](const B& b) -> C { return f(a, b); };
-                });
-            transaction trans;
-            auto ca = apply<B, C>(map(fa), bb);
-            trans.close();
-            return ca;
+            return cell<C>(impl::lift_n(f, this->impl_, bb.impl_));
         }
 
         /*!
@@ -185,16 +202,7 @@ namespace sodium {
         cell<typename std::result_of<Fn(A, B, C)>::type> lift(
             const cell<B>& bb, const cell<C>& bc, const Fn& f) const {
             typedef typename std::result_of<Fn(A, B, C)>::type D;
-            std::function<std::function<std::function<D(const C&)>(const B&)>(
-                const A&)>
-                fa([f](const A& a)
-                       -> std::function<std::function<D(const C&)>(const B&)> {
-                    return [f, a](const B& b) -> std::function<D(const C&)> {
-                        return
-                            [f, a, b](const C& c) -> D { return f(a, b, c); };
-                    };
-                });
-            return apply(apply(map(fa), bb), bc);
+            return cell<D>(impl::lift_n(f, this->impl_, bb.impl_, bc.impl_));
         }
 
         /*!
@@ -205,23 +213,8 @@ namespace sodium {
             const cell<B>& bb, const cell<C>& bc, const cell<D>& bd,
             const Fn& f) const {
             typedef typename std::result_of<Fn(A, B, C, D)>::type E;
-            std::function<std::function<std::function<
-                std::function<E(const D&)>(const C&)>(const B&)>(const A&)>
-                fa([f](const A& a)
-                       -> std::function<std::function<
-                           std::function<E(const D&)>(const C&)>(const B&)> {
-                    return [f, a](const B& b)
-                               -> std::function<std::function<E(const D&)>(
-                                   const C&)> {
-                        return [f, a,
-                                b](const C& c) -> std::function<E(const D&)> {
-                            return [f, a, b, c](const D& d) -> E {
-                                return f(a, b, c, d);
-                            };
-                        };
-                    };
-                });
-            return apply(apply(apply(map(fa), bb), bc), bd);
+            return cell<E>(impl::lift_n(f, this->impl_, bb.impl_, bc.impl_,
+                                        bd.impl_));
         }
 
         /*!
@@ -232,30 +225,8 @@ namespace sodium {
             const cell<B>& bb, const cell<C>& bc, const cell<D>& bd,
             const cell<E>& be, const Fn& f) const {
             typedef typename std::result_of<Fn(A, B, C, D, E)>::type F;
-            std::function<std::function<std::function<std::function<
-                std::function<F(const E&)>(const D&)>(const C&)>(const B&)>(
-                const A&)>
-                fa([f](const A& a)
-                       -> std::function<std::function<std::function<
-                           std::function<F(const E&)>(const D&)>(const C&)>(
-                           const B&)> {
-                    return [f, a](const B& b)
-                               -> std::function<std::function<std::function<F(
-                                   const E&)>(const D&)>(const C&)> {
-                        return [f, a, b](const C& c)
-                                   -> std::function<std::function<F(const E&)>(
-                                       const D&)> {
-                            return
-                                [f, a, b,
-                                 c](const D& d) -> std::function<F(const E&)> {
-                                    return [f, a, b, c, d](const E& e) -> F {
-                                        return f(a, b, c, d, e);
-                                    };
-                                };
-                        };
-                    };
-                });
-            return apply(apply(apply(apply(map(fa), bb), bc), bd), be);
+            return cell<F>(impl::lift_n(f, this->impl_, bb.impl_, bc.impl_,
+                                        bd.impl_, be.impl_));
         }
 
         /*!
@@ -264,41 +235,11 @@ namespace sodium {
         template <typename B, typename C, typename D, typename E, typename F,
                   typename Fn>
         cell<typename std::result_of<Fn(A, B, C, D, E, F)>::type> lift(
-            const cell<A>& ba, const cell<B>& bb, const cell<C>& bc,
-            const cell<D>& bd, const cell<E>& be, const cell<F>& bf,
-            const Fn& fn) const {
+            const cell<B>& bb, const cell<C>& bc, const cell<D>& bd,
+            const cell<E>& be, const cell<F>& bf, const Fn& fn) const {
             typedef typename std::result_of<Fn(A, B, C, D, E, F)>::type G;
-            std::function<std::function<std::function<std::function<
-                std::function<std::function<G(const F&)>(const E&)>(const D&)>(
-                const C&)>(const B&)>(const A&)>
-                fa([fn](const A& a)
-                       -> std::function<std::function<std::function<
-                           std::function<std::function<G(const F&)>(const E&)>(
-                               const D&)>(const C&)>(const B&)> {
-                    return [fn, a](const B& b)
-                               -> std::function<std::function<std::function<
-                                   std::function<G(const F&)>(const E&)>(
-                                   const D&)>(const C&)> {
-                        return [fn, a, b](const C& c)
-                                   -> std::function<std::function<std::function<
-                                       G(const F&)>(const E&)>(const D&)> {
-                            return
-                                [fn, a, b, c](const D& d)
-                                    -> std::function<std::function<G(const F&)>(
-                                        const E&)> {
-                                    return [fn, a, b, c, d](const E& e)
-                                               -> std::function<G(const F&)> {
-                                        return [fn, a, b, c, d,
-                                                e](const F& f) -> G {
-                                            return fn(a, b, c, d, e, f);
-                                        };
-                                    };
-                                };
-                        };
-                    };
-                });
-            return apply(apply(apply(apply(apply(map(fa), bb), bc), bd), be),
-                         bf);
+            return cell<G>(impl::lift_n(fn, this->impl_, bb.impl_, bc.impl_,
+                                        bd.impl_, be.impl_, bf.impl_));
         }
 
         /*!
@@ -307,53 +248,44 @@ namespace sodium {
         template <typename B, typename C, typename D, typename E, typename F,
                   typename G, typename Fn>
         cell<typename std::result_of<Fn(A, B, C, D, E, F, G)>::type> lift(
-            const cell<A>& ba, const cell<B>& bb, const cell<C>& bc,
+            const cell<B>& bb, const cell<C>& bc, const cell<D>& bd,
+            const cell<E>& be, const cell<F>& bf, const cell<G>& bg,
+            const Fn& fn) const {
+            typedef typename std::result_of<Fn(A, B, C, D, E, F, G)>::type H;
+            return cell<H>(impl::lift_n(fn, this->impl_, bb.impl_, bc.impl_,
+                                        bd.impl_, be.impl_, bf.impl_,
+                                        bg.impl_));
+        }
+
+        /*!
+         * Deprecated: the leading cell was never used, and this cell is the
+         * first input. Use the overload without it.
+         */
+        template <typename B, typename C, typename D, typename E, typename F,
+                  typename Fn>
+        cell<typename std::result_of<Fn(A, B, C, D, E, F)>::type> lift(
+            const cell<A>&, const cell<B>& bb, const cell<C>& bc,
+            const cell<D>& bd, const cell<E>& be, const cell<F>& bf,
+            const Fn& fn) const __attribute__((deprecated)) {
+            typedef typename std::result_of<Fn(A, B, C, D, E, F)>::type G;
+            return cell<G>(impl::lift_n(fn, this->impl_, bb.impl_, bc.impl_,
+                                        bd.impl_, be.impl_, bf.impl_));
+        }
+
+        /*!
+         * Deprecated: the leading cell was never used, and this cell is the
+         * first input. Use the overload without it.
+         */
+        template <typename B, typename C, typename D, typename E, typename F,
+                  typename G, typename Fn>
+        cell<typename std::result_of<Fn(A, B, C, D, E, F, G)>::type> lift(
+            const cell<A>&, const cell<B>& bb, const cell<C>& bc,
             const cell<D>& bd, const cell<E>& be, const cell<F>& bf,
-            const cell<G>& bg, const Fn& fn) const {
+            const cell<G>& bg, const Fn& fn) const __attribute__((deprecated)) {
             typedef typename std::result_of<Fn(A, B, C, D, E, F, G)>::type H;
-            std::function<std::function<std::function<std::function<
-                std::function<std::function<std::function<H(const G&)>(
-                    const F&)>(const E&)>(const D&)>(const C&)>(const B&)>(
-                const A&)>
-                fa([fn](const A& a)
-                       -> std::function<std::function<
-                           std::function<std::function<std::function<
-                               std::function<H(const G&)>(const F&)>(const E&)>(
-                               const D&)>(const C&)>(const B&)> {
-                    return [fn, a](const B& b)
-                               -> std::function<std::function<std::function<
-                                   std::function<std::function<H(const G&)>(
-                                       const F&)>(const E&)>(const D&)>(
-                                   const C&)> {
-                        return [fn, a, b](const C& c)
-                                   -> std::function<std::function<std::function<
-                                       std::function<H(const G&)>(const F&)>(
-                                       const E&)>(const D&)> {
-                            return
-                                [fn, a, b, c](const D& d)
-                                    -> std::function<std::function<
-                                        std::function<H(const G&)>(const F&)>(
-                                        const E&)> {
-                                    return [fn, a, b, c, d](const E& e)
-                                               -> std::function<std::function<H(
-                                                   const G&)>(const F&)> {
-                                        return
-                                            [fn, a, b, c, d, e](const F& f)
-                                                -> std::function<H(const G&)> {
-                                                return [fn, a, b, c, d, e,
-                                                        f](const G& g) {
-                                                    return fn(a, b, c, d, e, f,
-                                                              g);
-                                                };
-                                            };
-                                    };
-                                };
-                        };
-                    };
-                });
-            return apply(
-                apply(apply(apply(apply(apply(map(fa), bb), bc), bd), be), bf),
-                bg);
+            return cell<H>(impl::lift_n(fn, this->impl_, bb.impl_, bc.impl_,
+                                        bd.impl_, be.impl_, bf.impl_,
+                                        bg.impl_));
         }
 
         /*!
@@ -386,7 +318,7 @@ namespace sodium {
          */
         std::function<void()> listen(std::function<void(const A&)> handle) const {
             transaction trans;
-            auto kill = stream<A>(value_(trans.impl()))
+            auto kill = stream<A>(this->impl_.value())
                             .coalesce([](const A&, const A& b) { return b; })
                             .listen(handle);
             trans.close();
@@ -478,6 +410,9 @@ namespace sodium {
         friend stream<AA> switch_s(const cell<stream<AA>>& bea);
         template <typename AA>
         friend stream<AA> split(const stream<std::list<AA>>& e);
+        template <typename AA, typename L>
+        friend stream<AA> merge(const L& sas,
+                                const std::function<AA(const AA&, const AA&)>& f);
         template <typename AA> friend class sodium::stream_loop;
         template <typename AA, typename Selector> friend class sodium::router;
 
@@ -485,7 +420,9 @@ namespace sodium {
         /*!
          * The 'never' stream (that never fires).
          */
-        stream(): impl_(impl::sodium_ctx) {}
+        stream(): impl_(impl::current_sodium_ctx()) {}
+
+        stream(context& ctx): impl_(ctx.impl()) {}
 
     protected:
         impl::Stream<A> impl_;
@@ -590,25 +527,21 @@ namespace sodium {
             });
         }
 
-            private:
         /*!
          * If there's more than one firing in a single transaction, combine them
          * into one using the specified combining function.
          *
-         * If the stream firings are ordered, then the first will appear at the
-         * left input of the combining function. In most common cases it's best
-         * not to make any assumptions about the ordering, and the combining
-         * function would ideally be commutative.
+         * Here a stream never fires more than once per transaction: several
+         * sends to a stream_sink in one transaction are combined by the sink's
+         * own combining function, or the last one wins. So the stream is
+         * returned unchanged and combine is never called. It is kept for code
+         * written against other Sodium implementations.
          */
         template <typename F>
         stream<A> coalesce(F combine) const {
-            transaction trans;
-            stream<A> sa(coalesce_<A, F>(trans.impl(), std::move(combine)));
-            trans.close();
-            return sa;
+            return stream<A>(this->impl_.coalesce(std::move(combine)));
         }
 
-    public:
         /*!
          * A variant of {@link merge(Stream)} that uses the specified function
          * to combine simultaneous streams. <p> If the streams are simultaneous
@@ -671,7 +604,7 @@ namespace sodium {
             const cell<B>& bc, const cell<C>& cc, const Fn& f) const {
             typedef typename std::result_of<Fn(A, B, C)>::type D;
             return snapshot(bc, [cc, f](const A& a, const B& b) {
-                return f(a, b, cc.sample());
+                return f(a, b, cc.impl_.sample());
             });
         }
 
@@ -681,7 +614,7 @@ namespace sodium {
             const Fn& f) const {
             typedef typename std::result_of<Fn(A, B, C, D)>::type E;
             return snapshot(bc, [cc, cd, f](const A& a, const B& b) {
-                return f(a, b, cc.sample(), cd.sample());
+                return f(a, b, cc.impl_.sample(), cd.impl_.sample());
             });
         }
 
@@ -691,7 +624,7 @@ namespace sodium {
             const cell<E>& ce, const Fn& f) const {
             typedef typename std::result_of<Fn(A, B, C, D, E)>::type F;
             return snapshot(bc, [cc, cd, ce, f](const A& a, const B& b) {
-                return f(a, b, cc.sample(), cd.sample(), ce.sample());
+                return f(a, b, cc.impl_.sample(), cd.impl_.sample(), ce.impl_.sample());
             });
         }
 
@@ -702,8 +635,8 @@ namespace sodium {
             const cell<E>& ce, const cell<F>& cf, const Fn& f) const {
             typedef typename std::result_of<Fn(A, B, C, D, E, F)>::type G;
             return snapshot(bc, [cc, cd, ce, cf, f](const A& a, const B& b) {
-                return f(a, b, cc.sample(), cd.sample(), ce.sample(),
-                         cf.sample());
+                return f(a, b, cc.impl_.sample(), cd.impl_.sample(),
+                         ce.impl_.sample(), cf.impl_.sample());
             });
         }
 
@@ -742,7 +675,7 @@ namespace sodium {
         collect_lazy(const lazy<S>& initS, Fn f) const {
             typedef typename std::tuple_element<
                 0, typename std::result_of<Fn(A, S)>::type>::type B;
-            return stream<B>(this->impl_.collect_lazy(impl::Lazy<A>([initS]() { return initS(); }), f));
+            return stream<B>(this->impl_.collect_lazy(impl::Lazy<S>([initS]() { return initS(); }), f));
         }
 
         /*!
@@ -763,21 +696,7 @@ namespace sodium {
         stream<B> accum_s_lazy(
             const lazy<B>& initB,
             std::function<B(const A&, const B&)> f) const {
-            // TODO: Implement this
-            SODIUM_THROW("Not implemented yet!");
-            /*
-            transaction trans1;
-            SODIUM_SHARED_PTR<lazy<B>> pState(new lazy<B>(initB));
-            SODIUM_TUPLE<impl::stream_, SODIUM_SHARED_PTR<impl::node>> p =
-                impl::unsafe_new_stream();
-            auto kill = listen_raw(
-                trans1.impl(), SODIUM_TUPLE_GET<1>(p),
-                new impl::accum_s_handler<A, B>(pState, std::move(f)),
-                false);
-            stream<B> sb(SODIUM_TUPLE_GET<0>(p).unsafe_add_cleanup(kill));
-            trans1.close();
-            return sb;
-            */
+            return stream<B>(this->impl_.accum_s_lazy(impl::Lazy<B>([initB]() { return initB(); }), f));
         }
 
         template <typename B>
@@ -880,40 +799,26 @@ namespace sodium {
         return accum_s<B>(initB, f);
     }
 
-    namespace impl {
-        template <typename A, typename L>
-        stream<A> merge(const L& sas, size_t start, size_t end,
-                        const std::function<A(const A&, const A&)>& f) {
-            size_t len = end - start;
-            if (len == 0)
-                return stream<A>();
-            else if (len == 1)
-                return sas[start];
-            else if (len == 2)
-                return sas[start].merge(sas[start + 1], f);
-            else {
-                int mid = (start + end) / 2;
-                return merge<A, L>(sas, start, mid, f)
-                    .merge(merge<A, L>(sas, mid, end, f), f);
-            }
-        }
-    }  // namespace impl
-
     /*!
      * Variant of merge that merges a collection of streams.
      */
-    template <typename A, typename L> stream<A> or_else(const L& sas) {
-        return impl::merge<A, L>(sas, 0, sas.size(),
-                                 [](const A& l, const A& r) { return l; });
+    template <typename A, typename L>
+    stream<A> merge(const L& sas,
+                    const std::function<A(const A&, const A&)>& f) {
+        std::vector<impl::Stream<A>> impls;
+        impls.reserve(sas.size());
+        for (const stream<A>& sa : sas)
+            impls.push_back(sa.impl_);
+        if (impls.empty())
+            return stream<A>();
+        return stream<A>(impl::Stream<A>::merge_all(impls, f));
     }
 
     /*!
      * Variant of merge that merges a collection of streams.
      */
-    template <typename A, typename L>
-    stream<A> merge(const L& sas,
-                    const std::function<A(const A&, const A&)>& f) {
-        return impl::merge<A, L>(sas, 0, sas.size(), f);
+    template <typename A, typename L> stream<A> or_else(const L& sas) {
+        return merge<A, L>(sas, [](const A& l, const A& r) { return l; });
     }
 
     /*!
@@ -926,10 +831,16 @@ namespace sodium {
         stream_sink(const impl::StreamSink<A>& impl_) : impl_(impl_), stream(impl_.stream()) {}
 
     public:
-        stream_sink(): stream_sink(impl::StreamSink<A>(impl::sodium_ctx)) {
+        stream_sink(): stream_sink(impl::StreamSink<A>(impl::current_sodium_ctx())) {
         }
 
-        stream_sink(const std::function<A(const A&, const A&)>& f): stream_sink(impl::StreamSink<A>(impl::sodium_ctx, f)) {
+        stream_sink(const std::function<A(const A&, const A&)>& f): stream_sink(impl::StreamSink<A>(impl::current_sodium_ctx(), f)) {
+        }
+
+        stream_sink(context& ctx): stream_sink(impl::StreamSink<A>(ctx.impl())) {
+        }
+
+        stream_sink(context& ctx, const std::function<A(const A&, const A&)>& f): stream_sink(impl::StreamSink<A>(ctx.impl(), f)) {
         }
 
         void send(const A& a) const {
@@ -951,6 +862,55 @@ namespace sodium {
             this->impl_.send(std::move(a));
             trans.close();
         }
+
+        /*!
+         * Send every value in [begin, end). With drain_mode::one_transaction
+         * they all go in one transaction, combined with this sink's combining
+         * function, or the last one wins if it has none. With
+         * drain_mode::transaction_per_item each value gets a transaction of
+         * its own, as with repeated send(), but cycles are collected only
+         * once, after the last. Called inside an open transaction, every
+         * value joins that transaction whatever the mode, so only the
+         * combined or last value fires.
+         */
+        template <typename It>
+        void send_all(It begin, It end,
+                      drain_mode mode = drain_mode::one_transaction) const {
+            transaction trans;
+            if (trans.is_in_callback())
+                SODIUM_THROW(
+                    "You are not allowed to use send() inside a Sodium "
+                    "callback");
+            if (mode == drain_mode::transaction_per_item) {
+                trans.close();
+                this->impl_.send_each(begin, end);
+            }
+            else {
+                this->impl_.send_all(begin, end);
+                trans.close();
+            }
+        }
+
+        /*!
+         * Variant of send_all() that moves the values out of a vector.
+         */
+        void send_many(std::vector<A>&& as,
+                       drain_mode mode = drain_mode::one_transaction) const {
+            send_all(std::make_move_iterator(as.begin()),
+                     std::make_move_iterator(as.end()), mode);
+        }
+
+        /*!
+         * Queue a send from any thread, without blocking. It happens when the
+         * thread that uses this sink's context next calls drain_inbox().
+         * The sink itself must outlive the call and must not be reassigned
+         * concurrently. With drain_mode::one_transaction, values queued
+         * together on a sink without a combining function collapse to the
+         * last one.
+         */
+        void enqueue(const A& a) const {
+            this->impl_.enqueue(a);
+        }
     };
 
     /*!
@@ -976,10 +936,16 @@ namespace sodium {
         cell_sink(impl::CellSink<A> impl_) : impl_(impl_), cell<A>(impl_.cell()) {}
 
     public:
-        cell_sink(const A& initA): cell_sink(impl::CellSink<A>(impl::sodium_ctx, initA)) {
+        cell_sink(const A& initA): cell_sink(impl::CellSink<A>(impl::current_sodium_ctx(), initA)) {
+        }
+
+        cell_sink(A&& initA): cell_sink(impl::CellSink<A>(impl::current_sodium_ctx(), std::move(initA))) {
         }
 
-        cell_sink(A&& initA): cell_sink(impl::CellSink<A>(impl::sodium_ctx, std::move(initA))) {
+        cell_sink(context& ctx, const A& initA): cell_sink(impl::CellSink<A>(ctx.impl(), initA)) {
+        }
+
+        cell_sink(context& ctx, A&& initA): cell_sink(impl::CellSink<A>(ctx.impl(), std::move(initA))) {
         }
 
         void send(const A& a) const { impl_.send(a); }
@@ -1016,7 +982,10 @@ namespace sodium {
             : impl_(impl_), stream(impl_.stream()) {}
 
     public:
-        stream_loop(): stream_loop(impl::StreamLoop<A>(impl::sodium_ctx)) {
+        stream_loop(): stream_loop(impl::StreamLoop<A>(impl::current_sodium_ctx())) {
+        }
+
+        stream_loop(context& ctx): stream_loop(impl::StreamLoop<A>(ctx.impl())) {
         }
 
         void loop(const stream<A>& e) {
@@ -1042,7 +1011,10 @@ namespace sodium {
         }
 
     public:
-        cell_loop(): cell_loop(impl::CellLoop<A>(impl::sodium_ctx)) {
+        cell_loop(): cell_loop(impl::CellLoop<A>(impl::current_sodium_ctx())) {
+        }
+
+        cell_loop(context& ctx): cell_loop(impl::CellLoop<A>(ctx.impl())) {
         }
 
         void loop(const cell<A>& b) {
@@ -1098,14 +1070,7 @@ namespace sodium {
     template <typename A, typename B, typename C>
     cell<C> lift(const std::function<C(const A&, const B&)>& f,
                  const cell<A>& ba, const cell<B>& bb) {
-        std::function<std::function<C(const B&)>(const A&)> fa(
-            [f](const A& a) -> std::function<C(const B&)> {
-                return [f, a](const B& b) -> C { return f(a, b); };
-            });
-        transaction trans;
-        cell<C> cc = apply<B, C>(ba.map(fa), bb);
-        trans.close();
-        return cc;
+        return ba.lift(bb, f);
     }
 
     template <typename A, typename B, typename C, typename D>
@@ -1119,15 +1084,7 @@ namespace sodium {
     template <typename A, typename B, typename C, typename D>
     cell<D> lift(const std::function<D(const A&, const B&, const C&)>& f,
                  const cell<A>& ba, const cell<B>& bb, const cell<C>& bc) {
-        std::function<std::function<std::function<D(const C&)>(const B&)>(
-            const A&)>
-            fa([f](const A& a)
-                   -> std::function<std::function<D(const C&)>(const B&)> {
-                return [f, a](const B& b) -> std::function<D(const C&)> {
-                    return [f, a, b](const C& c) -> D { return f(a, b, c); };
-                };
-            });
-        return apply(apply(ba.map(fa), bb), bc);
+        return ba.lift(bb, bc, f);
     }
 
     template <typename A, typename B, typename C, typename D, typename E>
@@ -1144,23 +1101,7 @@ namespace sodium {
         const std::function<E(const A&, const B&, const C&, const D&)>& f,
         const cell<A>& ba, const cell<B>& bb, const cell<C>& bc,
         const cell<D>& bd) {
-        std::function<std::function<std::function<std::function<E(const D&)>(
-            const C&)>(const B&)>(const A&)>
-            fa([f](const A& a)
-                   -> std::function<std::function<std::function<E(const D&)>(
-                       const C&)>(const B&)> {
-                return
-                    [f, a](const B& b)
-                        -> std::function<std::function<E(const D&)>(const C&)> {
-                        return [f, a,
-                                b](const C& c) -> std::function<E(const D&)> {
-                            return [f, a, b, c](const D& d) -> E {
-                                return f(a, b, c, d);
-                            };
-                        };
-                    };
-            });
-        return apply(apply(apply(ba.map(fa), bb), bc), bd);
+        return ba.lift(bb, bc, bd, f);
     }
 
     template <typename A, typename B, typename C, typename D, typename E,
@@ -1180,29 +1121,7 @@ namespace sodium {
                                        const E&)>& f,
                  const cell<A>& ba, const cell<B>& bb, const cell<C>& bc,
                  const cell<D>& bd, const cell<E>& be) {
-        std::function<std::function<std::function<std::function<std::function<F(
-            const E&)>(const D&)>(const C&)>(const B&)>(const A&)>
-            fa([f](const A& a)
-                   -> std::function<std::function<std::function<std::function<F(
-                       const E&)>(const D&)>(const C&)>(const B&)> {
-                return
-                    [f, a](const B& b)
-                        -> std::function<std::function<
-                            std::function<F(const E&)>(const D&)>(const C&)> {
-                        return [f, a, b](const C& c)
-                                   -> std::function<std::function<F(const E&)>(
-                                       const D&)> {
-                            return
-                                [f, a, b,
-                                 c](const D& d) -> std::function<F(const E&)> {
-                                    return [f, a, b, c, d](const E& e) -> F {
-                                        return f(a, b, c, d, e);
-                                    };
-                                };
-                        };
-                    };
-            });
-        return apply(apply(apply(apply(ba.map(fa), bb), bc), bd), be);
+        return ba.lift(bb, bc, bd, be, f);
     }
 
     template <typename A, typename B, typename C, typename D, typename E,
@@ -1222,37 +1141,7 @@ namespace sodium {
                                        const E&, const F&)>& fn,
                  const cell<A>& ba, const cell<B>& bb, const cell<C>& bc,
                  const cell<D>& bd, const cell<E>& be, const cell<F>& bf) {
-        std::function<std::function<std::function<std::function<std::function<
-            std::function<G(const F&)>(const E&)>(const D&)>(const C&)>(
-            const B&)>(const A&)>
-            fa([fn](const A& a)
-                   -> std::function<std::function<std::function<std::function<
-                       std::function<G(const F&)>(const E&)>(const D&)>(
-                       const C&)>(const B&)> {
-                return [fn, a](const B& b)
-                           -> std::function<std::function<std::function<
-                               std::function<G(const F&)>(const E&)>(const D&)>(
-                               const C&)> {
-                    return [fn, a, b](const C& c)
-                               -> std::function<std::function<std::function<G(
-                                   const F&)>(const E&)>(const D&)> {
-                        return [fn, a, b, c](const D& d)
-                                   -> std::function<std::function<G(const F&)>(
-                                       const E&)> {
-                            return
-                                [fn, a, b, c,
-                                 d](const E& e) -> std::function<G(const F&)> {
-                                    return
-                                        [fn, a, b, c, d, e](const F& f) -> G {
-                                            return fn(a, b, c, d, e, f);
-                                        };
-                                };
-                        };
-                    };
-                };
-            });
-        return apply(apply(apply(apply(apply(ba.map(fa), bb), bc), bd), be),
-                     bf);
+        return ba.lift(bb, bc, bd, be, bf, fn);
     }
 
     template <typename A, typename B, typename C, typename D, typename E,
@@ -1273,43 +1162,7 @@ namespace sodium {
                  const cell<A>& ba, const cell<B>& bb, const cell<C>& bc,
                  const cell<D>& bd, const cell<E>& be, const cell<F>& bf,
                  const cell<G>& bg) {
-        std::function<std::function<std::function<std::function<std::function<
-            std::function<std::function<H(const G&)>(const F&)>(const E&)>(
-            const D&)>(const C&)>(const B&)>(const A&)>
-            fa([fn](const A& a)
-                   -> std::function<std::function<std::function<std::function<
-                       std::function<std::function<H(const G&)>(const F&)>(
-                           const E&)>(const D&)>(const C&)>(const B&)> {
-                return [fn, a](const B& b)
-                           -> std::function<std::function<std::function<
-                               std::function<std::function<H(const G&)>(
-                                   const F&)>(const E&)>(const D&)>(const C&)> {
-                    return [fn, a, b](const C& c)
-                               -> std::function<std::function<std::function<
-                                   std::function<H(const G&)>(const F&)>(
-                                   const E&)>(const D&)> {
-                        return [fn, a, b, c](const D& d)
-                                   -> std::function<std::function<std::function<
-                                       H(const G&)>(const F&)>(const E&)> {
-                            return
-                                [fn, a, b, c, d](const E& e)
-                                    -> std::function<std::function<H(const G&)>(
-                                        const F&)> {
-                                    return [fn, a, b, c, d, e](const F& f)
-                                               -> std::function<H(const G&)> {
-                                        return
-                                            [fn, a, b, c, d, e, f](const G& g) {
-                                                return fn(a, b, c, d, e, f, g);
-                                            };
-                                    };
-                                };
-                        };
-                    };
-                };
-            });
-        return apply(
-            apply(apply(apply(apply(apply(ba.map(fa), bb), bc), bd), be), bf),
-            bg);
+        return ba.lift(bb, bc, bd, be, bf, bg, fn);
     }
 
     /*!
@@ -73,7 +73,7 @@ int test() {
     sodium::impl::Cell<int> ci = sodium::impl::Cell<int>::switch_c(cci);
     sodium_ctx.transaction_void([]() {});
     sodium::impl::GcCtx gc_ctx;
-    sodium::impl::GcNode node(gc_ctx, "test_node", []() {}, [](std::function<sodium::impl::Tracer> tracer) {});
+    sodium::impl::GcNode node(gc_ctx, "test_node", []() {}, [](std::function<sodium::impl::Tracer>& tracer) {});
     std::cout << "test" << std::endl;
     return 0;
 }
@@ -1,21 +1,20 @@
+#include "sodium/context.h"
 #include "sodium/impl/sodium_ctx.h"
 
 namespace sodium {
 
-    namespace impl {
-        extern SodiumCtx sodium_ctx;
-    }
-
     class transaction
     {
         private:
             sodium::impl::Transaction impl_;
             // Disallow copying
-            transaction(const transaction&): impl_(impl::sodium_ctx) {}
+            transaction(const transaction&): impl_(impl::current_sodium_ctx()) {}
             // Disallow copying
             transaction& operator = (const transaction&) { return *this; };
         public:
-            transaction(): impl_(impl::sodium_ctx) {}
+            transaction(): impl_(impl::current_sodium_ctx()) {}
+
+            transaction(context& ctx): impl_(ctx.impl()) {}
             /*!
              * The destructor will close the transaction, so normally close() isn't needed.
              * But, in some cases you might want to close it earlier, and close() will do this for you.
@@ -33,7 +32,7 @@ namespace sodium {
             }*/
 
             void post(std::function<void()> f) {
-                impl::sodium_ctx.post(f);
+                impl_.sodium_ctx.post(f);
             }
 
             // TODO: Implement this
@@ -19,6 +19,8 @@ class test_sodium : public CppUnit::TestFixture {
     CPPUNIT_TEST(map);
     CPPUNIT_TEST(map_optional);
     CPPUNIT_TEST(merge_non_simultaneous);
+    CPPUNIT_TEST(merge_collection);
+    CPPUNIT_TEST(coalesce);
     CPPUNIT_TEST(filter);
     CPPUNIT_TEST(filter_optional1);
     CPPUNIT_TEST(loop_stream1);
@@ -27,6 +29,7 @@ class test_sodium : public CppUnit::TestFixture {
     CPPUNIT_TEST(once1);
     CPPUNIT_TEST(collect1);
     CPPUNIT_TEST(accum1);
+    CPPUNIT_TEST(accum_s1);
     // behaviour tests
     CPPUNIT_TEST(collect2);
     CPPUNIT_TEST(hold1);
@@ -36,6 +39,7 @@ class test_sodium : public CppUnit::TestFixture {
     CPPUNIT_TEST(value_const);
     CPPUNIT_TEST(constant_cell);
     CPPUNIT_TEST(value_then_map);
+    CPPUNIT_TEST(value_then_coalesce);
     CPPUNIT_TEST(value_then_snapshot);
     CPPUNIT_TEST(value_then_merge);
     CPPUNIT_TEST(value_then_filter1);
@@ -49,9 +53,11 @@ class test_sodium : public CppUnit::TestFixture {
     CPPUNIT_TEST(apply1);
     CPPUNIT_TEST(lift1);
     CPPUNIT_TEST(lift_glitch);
+    CPPUNIT_TEST(lift3_glitch);
     CPPUNIT_TEST(hold_is_delayed);
     CPPUNIT_TEST(switch_c1);
     CPPUNIT_TEST(switch_s1);
+    CPPUNIT_TEST(switch_s_under_fan_out);
     CPPUNIT_TEST(loop_cell);
     CPPUNIT_TEST(split1);
     CPPUNIT_TEST(add_cleanup1);
@@ -64,16 +70,29 @@ class test_sodium : public CppUnit::TestFixture {
     CPPUNIT_TEST(loop_switch_s);
     CPPUNIT_TEST(detach_sink);
     CPPUNIT_TEST(move_semantics);
-    //CPPUNIT_TEST(move_semantics_sink);
+    CPPUNIT_TEST(move_semantics_sink);
     CPPUNIT_TEST(move_semantics_hold);
+    CPPUNIT_TEST(over_aligned_payload);
     CPPUNIT_TEST(lift_from_simultaneous);
     CPPUNIT_TEST(stream_sink_combining);
+    CPPUNIT_TEST(stream_sink_send_all);
+    CPPUNIT_TEST(send_all_in_transaction);
     CPPUNIT_TEST(cant_send_in_handler);
-    /* TODO: router
+    CPPUNIT_TEST(send_does_not_allocate);
+    CPPUNIT_TEST(accum_does_not_allocate);
+    CPPUNIT_TEST(cell_values_are_shared);
+    CPPUNIT_TEST(graph_per_thread);
+    CPPUNIT_TEST(enqueue_from_threads);
+    CPPUNIT_TEST(incremental_collect_cycles);
+    CPPUNIT_TEST(collect_large_cycle);
+    CPPUNIT_TEST(collect_long_chain);
+    CPPUNIT_TEST(unlisten_out_of_order);
+    CPPUNIT_TEST(context_stats1);
+    CPPUNIT_TEST(streams_outlive_context);
     CPPUNIT_TEST(router1);
     CPPUNIT_TEST(router2);
     CPPUNIT_TEST(router_loop1);
-    */
+    CPPUNIT_TEST(router_cleanup);
     CPPUNIT_TEST(snapshot_initial_value);
     CPPUNIT_TEST_SUITE_END();
 
@@ -85,6 +104,7 @@ public:
     void map();
     void map_optional();
     void merge_non_simultaneous();
+    void merge_collection();
     void coalesce();
     void filter();
     void filter_optional1();
@@ -94,6 +114,7 @@ public:
     void once1();
     void collect1();
     void accum1();
+    void accum_s1();
     void collect2();
     void hold1();
     void snapshot1();
@@ -116,9 +137,11 @@ public:
     void apply1();
     void lift1();
     void lift_glitch();
+    void lift3_glitch();
     void hold_is_delayed();
     void switch_c1();
     void switch_s1();
+    void switch_s_under_fan_out();
     void loop_cell();
     void split1();
     void add_cleanup1();
@@ -131,14 +154,29 @@ public:
     void loop_switch_s();
     void detach_sink();
     void move_semantics();
-    //void move_semantics_sink();
+    void move_semantics_sink();
     void move_semantics_hold();
+    void over_aligned_payload();
     void lift_from_simultaneous();
     void stream_sink_combining();
+    void stream_sink_send_all();
+    void send_all_in_transaction();
     void cant_send_in_handler();
+    void send_does_not_allocate();
+    void accum_does_not_allocate();
+    void cell_values_are_shared();
+    void graph_per_thread();
+    void enqueue_from_threads();
+    void incremental_collect_cycles();
+    void collect_large_cycle();
+    void collect_long_chain();
+    void unlisten_out_of_order();
+    void context_stats1();
+    void streams_outlive_context();
     void router1();
     void router2();
     void router_loop1();
+    void router_cleanup();
     void snapshot_initial_value();
 };
 